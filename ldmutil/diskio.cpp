@@ -29,7 +29,9 @@
 */
 
 #include <climits>
+#include <cstdlib>
 #include <cstring>
+#include <string>
 #include <cerrno>
 #include <unistd.h>
 #include <sys/ioctl.h>
@@ -38,6 +40,8 @@
 #include "types.h"
 #include "error.h"
 #include "diskio.h"
+#include "iolimit.h"
+#include "ldm_parse.h"
 
 #ifndef __CYGWIN__
 #define open	open64
@@ -54,6 +58,7 @@ using namespace std;
 diskio::diskio(void)
 {
 	_open = false;
+	_fdata = -1;
 }
 
 diskio::~diskio(void)
@@ -65,6 +70,16 @@ void diskio::Open(const char* filename, bool readonly)
 {
 	Close();
 
+	// NAME.part[:SECTORS] is a capture made by "ldminfo --copy"
+	const char* colon = strrchr(filename, ':');
+	size_t len = colon ? colon - filename : strlen(filename);
+	if (len > 5 && strncmp(filename + len - 5, ".part", 5) == 0) {
+		string part(filename, len);
+		_readonly = readonly;
+		OpenCapture(part.c_str(), colon ? strtoull(colon + 1, 0, 0) : 0);
+		return;
+	}
+
 	if (!readonly) {
 #ifdef O_LARGEFILE
 		_fd = open(filename, O_RDWR | O_CREAT | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH); // typo: O_LARGEFILE, S_IRUSR ?
@@ -95,12 +110,60 @@ void diskio::Open(const char* filename, bool readonly)
 	_size = off;
 }
 
+void diskio::OpenCapture(const char* part, u64 sectors)
+{
+	string data(part);
+	data.replace(data.size() - 5, 5, ".data");
+
+	int flags = _readonly ? O_RDONLY : O_RDWR;
+	_fd = open(part, flags);
+	if (_fd == -1)
+		throw LDM_MKERROR( strerror(errno) );
+
+	_fdata = open(data.c_str(), flags);
+	off_t dsize = -1;
+	if (_fdata != -1) {
+		_part_size = lseek(_fd, 0, SEEK_END);
+		dsize = lseek(_fdata, 0, SEEK_END);
+	}
+	if (_fdata == -1 || dsize == -1 || _part_size == (u64) -1) {
+		int err = errno;
+		close(_fd);
+		if (_fdata != -1)
+			close(_fdata);
+		_fdata = -1;
+		throw LDM_MKERROR( strerror(err) );
+	}
+
+	// Without a size, trust the primary PRIVHEAD in the .part file
+	if (sectors == 0) {
+		u8 sect[__SECTORSIZE];
+		privhead_t ph;
+		if (pread(_fd, sect, __SECTORSIZE, 6 * __SECTORSIZE) == __SECTORSIZE &&
+		    raw_to_privhead(sect, &ph))
+			sectors = ph.db_start + ph.db_size;
+	}
+
+	_open = true;
+	_pos = 0;
+	_size = sectors * __SECTORSIZE;
+	_data_start = _size - dsize;
+
+	if (sectors == 0 || _size < (u64) dsize || _data_start < _part_size) {
+		Close();
+		throw LDM_MKERROR("Capture doesn't fit the disk size, use NAME.part:SECTORS.");
+	}
+}
+
 void diskio::Close(void)
 {
 	if (!_open)
 		return;
 
 	close(_fd);
+	if (_fdata != -1)
+		close(_fdata);
+	_fdata = -1;
 	_open = false;
 }
 
@@ -115,6 +178,11 @@ void diskio::SetPos(u64 sector)
 	if (_readonly && offset == _pos)
 		return;
 
+	if (_fdata != -1) {
+		_pos = offset;
+		return;
+	}
+
 //	cerr << "sector = " << sector << " __SECTORSIZE = " << __SECTORSIZE <<"\n";
 //	cerr << "sizeof(sector) = " << sizeof(sector) << "\n";
 
@@ -138,6 +206,13 @@ void diskio::Write(const void* src, int nsect, u64 pos)
 	size_t left = nsect * __SECTORSIZE;
 	const unsigned char* p = (const unsigned char*)src;
 
+	io_wait(left);
+
+	if (_fdata != -1) {
+		Transfer((void*)src, left, true);
+		return;
+	}
+
 	while(left > 0) {
 		ssize_t ret = write(_fd, p, left);
 		if (ret == -1)
@@ -156,6 +231,13 @@ void diskio::Read(void* dest, int nsect, u64 pos)
 	size_t left = nsect * __SECTORSIZE;
 	unsigned char* p = (unsigned char*)dest;
 
+	io_wait(left);
+
+	if (_fdata != -1) {
+		Transfer(dest, left, false);
+		return;
+	}
+
 	while(left > 0) {
 		ssize_t ret = read(_fd, p, left);
 		if (ret == -1)
@@ -166,6 +248,59 @@ void diskio::Read(void* dest, int nsect, u64 pos)
 	}
 }
 
+// Wait until everything written so far is on the disk.
+void diskio::Sync(void)
+{
+	if (fsync(_fd) == -1)
+		throw LDM_MKERROR( strerror(errno) );
+	if (_fdata != -1 && fsync(_fdata) == -1)
+		throw LDM_MKERROR( strerror(errno) );
+}
+
+// Map a capture's virtual disk onto its .part and .data files.  The gap
+// between them reads as zeros and can't be written.
+void diskio::Transfer(void* buf, size_t len, bool write)
+{
+	unsigned char* p = (unsigned char*)buf;
+
+	while (len > 0) {
+		size_t n = len;
+		int fd = _fd;
+		off_t off = _pos;
+
+		if (_pos + n > _size)
+			throw LDM_MKERROR("Access beyond the end of the capture.");
+
+		if (_pos < _part_size) {
+			if (n > _part_size - _pos)
+				n = _part_size - _pos;
+		} else if (_pos >= _data_start) {
+			fd = _fdata;
+			off = _pos - _data_start;
+		} else {
+			if (n > _data_start - _pos)
+				n = _data_start - _pos;
+			if (write)
+				throw LDM_MKERROR("Can't write to the gap in a capture.");
+			memset(p, 0, n);
+			fd = -1;
+		}
+
+		if (fd != -1) {
+			ssize_t ret = write ? pwrite(fd, p, n, off) : pread(fd, p, n, off);
+			if (ret == -1)
+				throw LDM_MKERROR( strerror(errno) );
+			if (ret == 0)
+				throw LDM_MKERROR("Capture file is truncated.");
+			n = ret;
+		}
+
+		p += n;
+		_pos += n;
+		len -= n;
+	}
+}
+
 u64 diskio::GetSize(void)
 {
 	return _size / __SECTORSIZE;
@@ -13,6 +13,11 @@ private:
 	bool	_readonly;
 	int	_fd;
 	u64	_pos;
+	int	_fdata;		// capture: the .data file, else -1
+	u64	_part_size;	// capture: bytes held by the .part file
+	u64	_data_start;	// capture: disk offset of the .data file
+	void OpenCapture(const char* part, u64 sectors);
+	void Transfer(void* buf, size_t len, bool write);
 public:
 	diskio(void);
 	~diskio(void);
@@ -23,6 +28,7 @@ public:
 	u64  GetPos(void);
 	void Write(const void* src, int nsect = 1, u64 pos = INT_MIN);
 	void Read(void* dest, int nsect = 1, u64 pos = INT_MIN);
+	void Sync(void);
 	u64  GetSize(void);
 };
 
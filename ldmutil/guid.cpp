@@ -0,0 +1,210 @@
+/**
+ * ldmutil - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Jakob Kemi <jakob.kemi@telia.com>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <cstring>
+
+#include "guid.h"
+
+using namespace ldm;
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define GUID_SSSE3
+#include <tmmintrin.h>
+#endif
+
+// Where the dashes go in the text form, and the 32 digits either side of them.
+static const int _dash[4] = { 8, 13, 18, 23 };
+static const int _run[5][2] = { { 0, 8 }, { 9, 4 }, { 14, 4 }, { 19, 4 }, { 24, 12 } };
+
+static const char _hexdigit[] = "0123456789ABCDEF";
+
+static void _pack(const char* text, char* digits)
+{
+	int o = 0;
+	for (int i = 0; i < 5; i++) {
+		memcpy(digits + o, text + _run[i][0], _run[i][1]);
+		o += _run[i][1];
+	}
+}
+
+static void _unpack(const char* digits, char* text)
+{
+	int o = 0;
+	for (int i = 0; i < 5; i++) {
+		memcpy(text + _run[i][0], digits + o, _run[i][1]);
+		o += _run[i][1];
+	}
+	for (int i = 0; i < 4; i++)
+		text[_dash[i]] = '-';
+}
+
+//***************************************************************************
+// Plain versions, one byte at a time.
+
+static int _hexval(unsigned char c)
+{
+	if ((unsigned)(c - '0') < 10)
+		return c - '0';
+	c |= 0x20;			// fold to lower case
+	if ((unsigned)(c - 'a') < 6)
+		return c - 'a' + 10;
+	return -1;
+}
+
+static bool _parse_plain(const char* digits, u8* guid)
+{
+	for (int i = 0; i < 16; i++) {
+		int h = _hexval(digits[2 * i]);
+		int l = _hexval(digits[2 * i + 1]);
+		if ((h | l) < 0)
+			return false;
+		guid[i] = (h << 4) | l;
+	}
+	return true;
+}
+
+static void _format_plain(const u8* guid, char* digits)
+{
+	for (int i = 0; i < 16; i++) {
+		digits[2 * i]     = _hexdigit[guid[i] >> 4];
+		digits[2 * i + 1] = _hexdigit[guid[i] & 15];
+	}
+}
+
+//***************************************************************************
+// SSSE3 versions, sixteen digits at a time.
+
+#ifdef GUID_SSSE3
+
+// Turn 16 hex digits into their values.  Returns a mask with a bit set for
+// each character that wasn't a hex digit.
+__attribute__((target("ssse3")))
+static int _hexval16(__m128i c, __m128i* val)
+{
+	const __m128i l = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+	// Bytes >= 0x80 are negative, so they fail both range checks.
+	__m128i isdig = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+				      _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+	__m128i islet = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+				      _mm_cmplt_epi8(l, _mm_set1_epi8('f' + 1)));
+
+	*val = _mm_or_si128(
+		_mm_and_si128(isdig, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+		_mm_and_si128(islet, _mm_sub_epi8(l, _mm_set1_epi8('a' - 10))));
+
+	return ~_mm_movemask_epi8(_mm_or_si128(isdig, islet)) & 0xFFFF;
+}
+
+__attribute__((target("ssse3")))
+static bool _parse_ssse3(const char* digits, u8* guid)
+{
+	__m128i a, b;
+	int bad;
+
+	bad  = _hexval16(_mm_loadu_si128((const __m128i*)digits), &a);
+	bad |= _hexval16(_mm_loadu_si128((const __m128i*)(digits + 16)), &b);
+	if (bad)
+		return false;
+
+	// hi * 16 + lo for each pair of digits, then narrow to bytes.
+	const __m128i weight = _mm_set1_epi16(0x0110);
+	a = _mm_maddubs_epi16(a, weight);
+	b = _mm_maddubs_epi16(b, weight);
+	_mm_storeu_si128((__m128i*)guid, _mm_packus_epi16(a, b));
+	return true;
+}
+
+__attribute__((target("ssse3")))
+static void _format_ssse3(const u8* guid, char* digits)
+{
+	const __m128i table = _mm_loadu_si128((const __m128i*)_hexdigit);
+	const __m128i low = _mm_set1_epi8(0x0F);
+	__m128i g = _mm_loadu_si128((const __m128i*)guid);
+
+	__m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(g, 4), low));
+	__m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(g, low));
+
+	_mm_storeu_si128((__m128i*)digits,        _mm_unpacklo_epi8(hi, lo));
+	_mm_storeu_si128((__m128i*)(digits + 16), _mm_unpackhi_epi8(hi, lo));
+}
+
+#endif
+
+//***************************************************************************
+// Pick an implementation the first time we're called.
+
+static bool _parse_init(const char* digits, u8* guid);
+static void _format_init(const u8* guid, char* digits);
+
+static bool (*_parse)(const char*, u8*) = _parse_init;
+static void (*_format)(const u8*, char*) = _format_init;
+
+static void _select()
+{
+#ifdef GUID_SSSE3
+	if (__builtin_cpu_supports("ssse3")) {
+		_parse  = _parse_ssse3;
+		_format = _format_ssse3;
+		return;
+	}
+#endif
+	_parse  = _parse_plain;
+	_format = _format_plain;
+}
+
+static bool _parse_init(const char* digits, u8* guid)
+{
+	_select();
+	return _parse(digits, guid);
+}
+
+static void _format_init(const u8* guid, char* digits)
+{
+	_select();
+	_format(guid, digits);
+}
+
+//***************************************************************************
+
+
+bool ldm::guid_parse(const char* text, u8* guid)
+{
+	char digits[32];
+
+	for (int i = 0; i < 4; i++)
+		if (text[_dash[i]] != '-')
+			return false;
+
+	_pack(text, digits);
+	return _parse(digits, guid);
+}
+
+void ldm::guid_format(const u8* guid, char* text)
+{
+	char digits[32];
+
+	_format(guid, digits);
+	_unpack(digits, text);
+	text[GUID_TEXT_LEN] = '\0';
+}
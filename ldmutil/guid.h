@@ -0,0 +1,18 @@
+#ifndef __LDM_GUID_H__
+#define __LDM_GUID_H__
+
+#include "types.h"
+
+namespace ldm {
+
+#define GUID_TEXT_LEN		36	// fa50ff2b-f2e8-45de-83fa-65417f2f49ba
+
+// Text to binary.  The text need not be terminated and may use either case.
+// Returns false, leaving guid undefined, if it isn't a well-formed GUID.
+bool guid_parse(const char* text, u8* guid);
+
+// Binary to upper case text.  text must hold GUID_TEXT_LEN + 1 chars.
+void guid_format(const u8* guid, char* text);
+
+}	// namespace ldm
+#endif
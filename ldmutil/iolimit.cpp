@@ -0,0 +1,135 @@
+/**
+ * ldmutil - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Jakob Kemi <jakob.kemi@telia.com>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "error.h"
+#include "iolimit.h"
+
+using namespace ldm;
+
+// A token bucket for each limit, one token per I/O or per byte.  An I/O waits
+// until neither bucket is in debt, then takes what it needs, which may put
+// them in debt: that way a single large transfer can't wait forever.  The
+// buckets hold no more than a tenth of a second's worth, so the I/O is spread
+// out evenly instead of coming in bursts.
+//
+// Levels are kept in millionths of a token, so that a refill is just the
+// rate times the microseconds since the last one.
+
+struct _bucket_t {
+	u64	rate;		// Tokens per second, 0 for no limit
+	s64	level;		// Millionths of a token
+	s64	when;		// Time of the last refill, in microseconds
+};
+
+static _bucket_t _ops = { 0, 0, 0 };
+static _bucket_t _bytes = { 0, 0, 0 };
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+static s64 _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Top up a bucket.  Returns the microseconds until it's out of debt.
+static s64 _refill(_bucket_t& b, s64 now)
+{
+	if (b.rate == 0)
+		return 0;
+
+	s64 full = b.rate * 100000;		// 0.1 s worth
+	if (b.when == 0)
+		b.level = full;
+	else
+		b.level += b.rate * (now - b.when);
+	if (b.level > full)
+		b.level = full;
+	b.when = now;
+
+	return b.level >= 0 ? 0 : -b.level / (s64)b.rate + 1;
+}
+
+void ldm::io_limit(u32 iops, u64 bytes_per_sec)
+{
+	pthread_mutex_lock(&_lock);
+	_ops.rate = iops;
+	_ops.when = 0;
+	_bytes.rate = bytes_per_sec;
+	_bytes.when = 0;
+	pthread_mutex_unlock(&_lock);
+}
+
+void ldm::io_wait(size_t bytes)
+{
+	for (;;) {
+		pthread_mutex_lock(&_lock);
+		s64 now = _now();
+		s64 wait = _refill(_ops, now);
+		s64 w = _refill(_bytes, now);
+		if (w > wait)
+			wait = w;
+		if (wait == 0) {
+			_ops.level -= 1000000;
+			_bytes.level -= (s64)bytes * 1000000;
+			pthread_mutex_unlock(&_lock);
+			return;
+		}
+		pthread_mutex_unlock(&_lock);
+		usleep(wait);
+	}
+}
+
+// From linux/ioprio.h, which userspace doesn't get.
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_BE		2
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+
+void ldm::io_set_class(const char* name)
+{
+	int prio;
+
+	if (strcmp(name, "idle") == 0)
+		prio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+	else if (strcmp(name, "best-effort") == 0)
+		prio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7;	// The lowest
+	else
+		throw LDM_MKERROR("Unknown I/O class, use idle or best-effort.");
+
+#ifdef SYS_ioprio_set
+	// Threads started later inherit it
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, prio) == -1)
+		throw LDM_MKERROR( strerror(errno) );
+#else
+	throw LDM_MKERROR("I/O priorities aren't supported here.");
+#endif
+}
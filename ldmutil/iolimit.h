@@ -0,0 +1,22 @@
+#ifndef __LDM_IOLIMIT_H__
+#define __LDM_IOLIMIT_H__
+
+#include <cstddef>
+#include "types.h"
+
+namespace ldm {
+
+// Limits on the rate of I/O, so that a scan or a copy doesn't get in the way
+// of the disks' real work.  They are shared by every diskio, in every thread.
+// Zero means no limit.
+void io_limit(u32 iops, u64 bytes_per_sec);
+
+// Wait until an I/O of this many bytes is allowed.
+void io_wait(size_t bytes);
+
+// Set the I/O priority class of the process: "idle" or "best-effort".
+// Throws if the name is unknown or the kernel refuses.
+void io_set_class(const char* name);
+
+}	// namespace ldm
+#endif
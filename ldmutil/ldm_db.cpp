@@ -23,21 +23,21 @@
 
 #include <iostream>
 #include <iomanip>
-#include <list>
-#include <map>
+#include <vector>
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
 
 #include "types.h"
 #include "error.h"
 #include "ldm_parse.h"
+#include "vblk_view.h"
 #include "ptypenames.h"
 
 #include "ldm_db.h"
 
 #define LDM_DB_SIZE		2048		// Size in sectors (= 1 mb).
 #define LDM_SECT_SIZE		512
-#define LDM_VBLK_SIZE		128
 
 using namespace std;
 using namespace ldm;
@@ -45,6 +45,25 @@ using namespace ldm;
 static const u32 _ldm_off_ph[3] = {6, 1856, 2047};   // 2 & 3 is relative db
 static const u32 _ldm_off_tb[4] = {1, 2, 2045, 2046};// relative db
 
+struct _id_less {
+	template <class T>
+	bool operator () (const T& a, const T& b) const {return (a.id < b.id);}
+	template <class T>
+	bool operator () (const T& a, u64 id) const {return (a.id < id);}
+};
+
+// Binary search a vector sorted by id.
+template <class T>
+static T* _find(std::vector<T>& v, u64 id)
+{
+	typename std::vector<T>::iterator i;
+
+	i = std::lower_bound(v.begin(), v.end(), id, _id_less());
+	if (i == v.end() || i->id != id)
+		return 0;
+	return &*i;
+}
+
 void ldmdb_c::Read(diskio& dev)
 {
 	u8 sect[LDM_SECT_SIZE];
@@ -97,49 +116,72 @@ void ldmdb_c::Read(diskio& dev)
 	if (vm.vblk_size != LDM_VBLK_SIZE)
 		throw LDM_MKERROR("Illegal VBLK size.\n");
 
-	std::map<u32, u32> compmap;
-	u32 s = ph.db_start + tb.bitmap1_start;
-// read vblks
-	for (i = 0; i < vm.seqlast; i++)
+	std::vector<Component> comps;
+	u64 s = ph.db_start + tb.bitmap1_start;
+
+	_vols.clear();
+	_disks.clear();
+	_parts.clear();
+	_vblks.clear();
+	_edits.clear();
+	_where.clear();
+	_vmdb_sect = s;
+
+// read vblks, which follow the VMDB's four slots
+	for (i = 0; i + 4 < vm.seqlast; i++)
 	{
-		vblk_t tvblk;
 		if ((i & 0x3) == 0) {
 			dev.Read(sect);
+			_vblks.insert(_vblks.end(), sect, sect + LDM_SECT_SIZE);
 			s++;
 		}
 
-		if (!raw_to_vblk(sect + (i&0x03) * LDM_VBLK_SIZE, &tvblk))
+		// Decode straight from the sector
+		u8* raw = sect + (i & 0x03) * LDM_VBLK_SIZE;
+		vblk_view vb(raw);
+		if (!vb.valid())
 			continue;
 
 		// add vblks to correct container
-		switch (tvblk.recordtype) {
-			Partition tpart;
-
+		switch (vb.type()) {
 			case LDM_VBLK_COMPONENT:
-				compmap[tvblk.objectid] = tvblk.component.parentid;
+				{
+					Component c;
+					c.id = vb.objectid();
+					c.p_id = component_view(raw).parentid();
+					comps.push_back(c);
+				}
 				break;
 			case LDM_VBLK_DISK1:
 			case LDM_VBLK_DISK2:
-				_diskmap[ tvblk.objectid ].id = tvblk.objectid;
-				strncpy(_diskmap[ tvblk.objectid ].name, tvblk.objname, LDM_VBLK_MAX_NAME);
+				{
+					Disk d;
+					d.id = vb.objectid();
+					vb.name(d.name, LDM_VBLK_MAX_NAME);
+					_disks.push_back(d);
+				}
 				break;
 			case LDM_VBLK_PARTITION:
-				tpart.id = tvblk.objectid;
-				tpart.p_id = tvblk.partition.parentid;
-				tpart.start = ph.disk_start + tvblk.partition.start;
-				tpart.size = tvblk.partition.size;
-				tpart.vol = 0;
-				_diskmap[ tvblk.partition.diskid ].partlist.push_back(tpart);
+				{
+					partition_view pv(raw);
+					Partition tpart;
+					tpart.id = vb.objectid();
+					tpart.p_id = pv.parentid();
+					tpart.disk_id = pv.diskid();
+					tpart.start = ph.disk_start + pv.start();
+					tpart.size = pv.size();
+					tpart.vol = 0;
+					_parts.push_back(tpart);
+				}
 				break;
 			case LDM_VBLK_VOLUME:
 				{
 					Volume tvol;
-					tvol.id = tvblk.objectid;
-					tvol.type = tvblk.volume.type;
-					tvol.toffset = tvblk.volume.type_at_offset;
+					tvol.id = vb.objectid();
+					tvol.type = volume_view(raw).part_type();
 					tvol.vblk_sect = s;
 					tvol.vblk_subsect = i & 0x3;
-					_volmap[tvblk.objectid] = tvol;
+					_vols.push_back(tvol);
 				}
 				break;
 			default:
@@ -147,17 +189,46 @@ void ldmdb_c::Read(diskio& dev)
 		}
 	}
 
-	// add partitions sorted to parent disks
-	std::map<u32, Disk>::iterator mi;
-	for (mi = _diskmap.begin(); mi != _diskmap.end(); mi++) {
-		Disk& d = (*mi).second;
-		std::list<Partition>::iterator li;
-		for (li = d.partlist.begin(); li != d.partlist.end(); li++) {
-			Partition& part = *li;
-			part.vol = &_volmap[ compmap[part.p_id] ];
-		}
-		d.partlist.sort();
+	std::sort(comps.begin(), comps.end(), _id_less());
+	std::sort(_vols.begin(), _vols.end(), _id_less());
+	std::sort(_disks.begin(), _disks.end(), _id_less());
+	std::sort(_parts.begin(), _parts.end());
+
+	// A partition on a disk we haven't seen gets a nameless disk, which
+	// Dump() will complain about.
+	std::vector<Partition>::iterator pi;
+	for (pi = _parts.begin(); pi != _parts.end(); pi++) {
+		if (_find(_disks, pi->disk_id))
+			continue;
+		Disk d;
+		d.id = pi->disk_id;
+		_disks.insert(std::lower_bound(_disks.begin(), _disks.end(), d.id, _id_less()), d);
+	}
+
+	// link partitions to their volumes, and disks to their partitions
+	u32 n;
+	for (n = 0; n < _parts.size(); n++) {
+		Partition& part = _parts[n];
+		Component* c = _find(comps, part.p_id);
+		Volume* v = c ? _find(_vols, c->p_id) : 0;
+		part.vol = v ? v : &_novol;
+
+		Disk* d = _find(_disks, part.disk_id);
+		if (d->first == d->last)
+			d->first = n;
+		d->last = n + 1;
 	}
+
+	_ph = ph;
+	_vm = vm;
+}
+
+// Is db a copy of this database, from another disk of the same group?
+bool ldmdb_c::SameDatabase(const ldmdb_c& db) const
+{
+	return (strcmp(_vm.dg_guid, db._vm.dg_guid) == 0 &&
+		_vm.committed_seq == db._vm.committed_seq &&
+		_vblks == db._vblks);
 }
 
 void ldmdb_c::Dump(std::ostream& s)
@@ -166,24 +237,24 @@ void ldmdb_c::Dump(std::ostream& s)
 	s << "|  id  | Start (sect) | Size (Mb) | Vol. id | Type |      Type description     |\n";
 	s << "+------+--------------+-----------+---------+------|---------------------------+\n";
 
-	std::map<u32, Disk>::iterator mi;
-	for (mi = _diskmap.begin(); mi != _diskmap.end(); mi++) {
-		Disk& d = (*mi).second;
+	std::vector<Disk>::iterator mi;
+	for (mi = _disks.begin(); mi != _disks.end(); mi++) {
+		const Disk& d = *mi;
 
 		if (strlen(d.name) == 0)
 			throw LDM_MKERROR("Bad disk entry found.");
 
 		s << " Disk '" << d.name << "' (" << d.id << "):\n";
 
-		std::list<Partition>::iterator i;
-		for (i = d.partlist.begin(); i != d.partlist.end(); i++)
+		u32 i;
+		for (i = d.first; i < d.last; i++)
 		{
-			const Partition& part = *i;
+			const Partition& part = _parts[i];
 			const int type = part.vol->type;
 
 			s << setw(7) << part.id;
 			s << setw(15) << part.start;
-			s << setw(12) << part.size / 2048.0f;
+			s << setw(12) << setprecision(12) << part.size / 2048.0;
 			s << setw(8) << part.vol->id;
 			s << hex << setw(9) << type << dec;
 			s << "  " << setw(26) << PTYPE_NAMES[type];
@@ -192,18 +263,274 @@ void ldmdb_c::Dump(std::ostream& s)
 	}
 }
 
-void ldmdb_c::ChangeVolType(diskio& dev, u32 id, u8 type)
+void ldmdb_c::ChangeVolType(diskio& dev, u64 id, u8 type)
 {
-	u8 sect[LDM_SECT_SIZE];
-	Volume& vol = _volmap[id];
-	vblk_t vb;
+	SetVolType(id, type);
+	Commit(dev);
+}
+
+// Change a volume's type in memory.  Nothing is written until Commit().
+void ldmdb_c::SetVolType(u64 id, u8 type)
+{
+	Volume* v = _find(_vols, id);
 
-	if (vol.id != id)
+	if (!v)
 		throw LDM_MKERROR("Volume id not found.");
 
-	dev.Read(sect, 1, vol.vblk_sect);
+	v->type = type;
+
+	Edit e;
+	e.sect = v->vblk_sect;
+	e.subsect = v->vblk_subsect;
+	e.type = type;
+	_edits.push_back(e);
+}
+
+// Write all the pending edits, and move the VMDB's sequence number on.
+// Returns the number of VBLK sectors changed.
+int ldmdb_c::Commit(diskio& dev)
+{
+	int n = Stage(dev);
+
+	WritePending(dev);
+	WriteStaged(dev);
+	WriteCommitted(dev);
+	return n;
+}
+
+// Read each sector with a pending edit once, and make all its changes in
+// memory.  Everything is checked here, before anything is written.
+// Returns the number of VBLK sectors to be written.
+int ldmdb_c::Stage(diskio& dev)
+{
+	_staged.clear();
+	_where.clear();
+	if (_edits.empty())
+		return 0;
+
+	// Same sector edits stay in the order they were made
+	std::stable_sort(_edits.begin(), _edits.end());
+
+	std::vector<Edit>::iterator e;
+	for (e = _edits.begin(); e != _edits.end(); e++) {
+		if (_where.empty() || _where.back() != e->sect) {
+			_where.push_back(e->sect);
+			_staged.resize(_where.size() * LDM_SECT_SIZE);
+			dev.Read(&_staged[_staged.size() - LDM_SECT_SIZE], 1, e->sect);
+		}
+
+		u8* raw = &_staged[_staged.size() - LDM_SECT_SIZE] + e->subsect * LDM_VBLK_SIZE;
+		volume_view vv(raw);
+		if (!vv.valid() || vv.type() != LDM_VBLK_VOLUME || !vv.set_part_type(e->type))
+			throw LDM_MKERROR("Volume VBLK has moved.");
+	}
+	_edits.clear();
+
+	ReadVmdb(dev);
+	return _where.size();
+}
+
+// Read the VMDB, to be written by the steps below, and check nobody else has
+// changed the database in the meantime.
+void ldmdb_c::ReadVmdb(diskio& dev)
+{
+	vmdb_t vm;
+
+	_vmdb.resize(LDM_SECT_SIZE);
+	dev.Read(&_vmdb[0], 1, _vmdb_sect);
+	if (!raw_to_vmdb(&_vmdb[0], &vm) || vm.committed_seq != _vm.committed_seq)
+		throw LDM_MKERROR("The database has changed since it was read.\n");
+}
+
+void ldmdb_c::StageSector(const u8* sect, u64 where)
+{
+	_staged.insert(_staged.end(), sect, sect + LDM_SECT_SIZE);
+	_where.push_back(where);
+}
+
+// A fragmented VBLK, while its records are collected.
+struct _frag_t {
+	u32 group;
+	u16 num;
+	u8 map;
+	std::vector<u8> data;	// the records, without their headers
+};
+
+// Add a slot to the end of the packed VBLKs.  Its sequence number is its
+// place in the database, after the VMDB's four.
+static void _put_vblk(std::vector<u8>& area, u32 group, u16 rec, u16 num, const u8* data)
+{
+	u8 raw[LDM_VBLK_SIZE];
+	u32 t;
+	u16 h;
+
+	memset(raw, 0, sizeof(raw));
+	t = __cpu_to_be32(0x56424C4BUL);		// "VBLK"
+	memcpy(raw, &t, 4);
+	t = __cpu_to_be32(area.size() / LDM_VBLK_SIZE + 4);
+	memcpy(raw + 0x04, &t, 4);
+	t = __cpu_to_be32(group);
+	memcpy(raw + 0x08, &t, 4);
+	h = __cpu_to_be16(rec);
+	memcpy(raw + 0x0C, &h, 2);
+	h = __cpu_to_be16(num);
+	memcpy(raw + 0x0E, &h, 2);
+	if (data)
+		memcpy(raw + 0x10, data, LDM_VBLK_SIZE - 0x10);
+
+	area.insert(area.end(), raw, raw + LDM_VBLK_SIZE);
+}
+
+// Rewrite the database with the VBLKs in use packed together at the start,
+// in the order they're read now.  A fragmented VBLK that fits in one record
+// is joined up; a bigger one keeps its records, side by side.  The VMDB's
+// last sequence number and the size of the "config" bitmap in every
+// TOCBLOCK shrink to match, and the slots that are left over are emptied.
+//
+// Like Stage(), this reads and checks everything before anything is written
+// and then the steps below write it.  Read() the database again before
+// making any other changes.  Returns the number of sectors to be written.
+int ldmdb_c::Compact(diskio& dev)
+{
+	const u32 per = LDM_SECT_SIZE / LDM_VBLK_SIZE;
+	const u32 body = LDM_VBLK_SIZE - 0x10;
+	std::vector<u8> area;
+	std::vector<_frag_t> frags;
+	u8 sect[LDM_SECT_SIZE];
+	tocblock_t tb;
+	u32 i, j, seqlast;
+	int ntocs;
+
+	_staged.clear();
+	_where.clear();
+	if (!_edits.empty())
+		throw LDM_MKERROR("Commit the changes before packing the database.");
+
+	for (i = 0; i + per < _vm.seqlast; i++) {
+		const u8* raw = &_vblks[i * LDM_VBLK_SIZE];
+		vblk_view vb((void*)raw);
+
+		if (vb.signature() != 0x56424C4BUL)
+			throw LDM_MKERROR("Expected to find a VBLK.");
+
+		u32 group = __be32_to_cpu(*(u32*)(raw + 0x08));
+		u16 rec = vb.record();
+		u16 num = vb.nrecords();
+
+		if (num == 0)
+			continue;			// not in use
+		if (num == 1) {
+			_put_vblk(area, group, 0, 1, raw + 0x10);
+			continue;
+		}
+		if (num > 4 || rec >= num)
+			throw LDM_MKERROR("Bad VBLK fragment.");
+
+		for (j = 0; j < frags.size() && frags[j].group != group; j++)
+			;
+		if (j == frags.size()) {
+			frags.resize(j + 1);
+			frags[j].group = group;
+			frags[j].num = num;
+			frags[j].map = 0xFF << num;
+			frags[j].data.resize(num * body);
+		}
+		_frag_t& f = frags[j];
+		if (f.num != num || (f.map & (1 << rec)))
+			throw LDM_MKERROR("Bad VBLK fragment.");
+		f.map |= 1 << rec;
+		memcpy(&f.data[rec * body], raw + 0x10, body);
+		if (f.map != 0xFF)
+			continue;
+
+		// The size of the VBLK follows its header
+		u32 size = __be32_to_cpu(*(u32*)&f.data[0x14 - 0x10]);
+		if (0x18 + size <= LDM_VBLK_SIZE)
+			_put_vblk(area, group, 0, 1, &f.data[0]);
+		else
+			for (rec = 0; rec < num; rec++)
+				_put_vblk(area, group, rec, num, &f.data[rec * body]);
+		frags.erase(frags.begin() + j);
+	}
+	if (!frags.empty())
+		throw LDM_MKERROR("A fragmented VBLK is incomplete.");
+
+	// Whole sectors
+	while ((area.size() / LDM_VBLK_SIZE) % per)
+		_put_vblk(area, 0, 0, 0, 0);
+
+	seqlast = area.size() / LDM_VBLK_SIZE + per;
+	if (seqlast > _vm.seqlast)
+		throw LDM_MKERROR("No room to pack the database.");
+
+	// The VBLKs, then empty slots up to the old end
+	for (i = 0; i < _vm.seqlast / per - 1; i++) {
+		if (area.size() < (i + 1) * LDM_SECT_SIZE)
+			for (j = 0; j < per; j++)
+				_put_vblk(area, 0, 0, 0, 0);
+
+		const u8* s = &area[i * LDM_SECT_SIZE];
+		if (memcmp(s, &_vblks[i * LDM_SECT_SIZE], LDM_SECT_SIZE) != 0)
+			StageSector(s, _vmdb_sect + 1 + i);
+	}
+
+	for (ntocs = i = 0; i < 4; i++) {
+		dev.Read(sect, 1, _ph.db_start + _ldm_off_tb[i]);
+		if (!raw_to_tocblock(sect, &tb))
+			continue;
+		if (_ph.db_start + tb.bitmap1_start != _vmdb_sect ||
+		    !tocblock_set_config_size(sect, seqlast * LDM_VBLK_SIZE / LDM_SECT_SIZE))
+			throw LDM_MKERROR("Unexpected TOCBLOCK.");
+		ntocs++;
+		if (tb.bitmap1_size != seqlast * LDM_VBLK_SIZE / LDM_SECT_SIZE)
+			StageSector(sect, _ph.db_start + _ldm_off_tb[i]);
+	}
+	if (ntocs == 0)
+		throw LDM_MKERROR("Unable to find a valid tocblock\n");
+
+	if (_where.empty())
+		return 0;
+
+	ReadVmdb(dev);
+	_vm.seqlast = seqlast;
+	return _where.size();
+}
+
+// Step 1: Mark the database as being changed.  A crash from here on leaves
+// the pending sequence number ahead of the committed one.
+void ldmdb_c::WritePending(diskio& dev)
+{
+	if (_where.empty())
+		return;
+
+	vmdb_set_seq(&_vmdb[0], _vm.committed_seq, _vm.committed_seq + 1);
+	dev.Write(&_vmdb[0], 1, _vmdb_sect);
+	dev.Sync();
+}
+
+// Step 2: Write the changed VBLKs.
+void ldmdb_c::WriteStaged(diskio& dev)
+{
+	u32 i;
+
+	for (i = 0; i < _where.size(); i++)
+		dev.Write(&_staged[i * LDM_SECT_SIZE], 1, _where[i]);
+	dev.Sync();
+}
+
+// Step 3: Mark the change as finished.
+void ldmdb_c::WriteCommitted(diskio& dev)
+{
+	if (_where.empty())
+		return;
 
-	sect[vol.vblk_subsect * LDM_VBLK_SIZE + vol.toffset] = type;
+	_vm.committed_seq++;
+	_vm.pending_seq = _vm.committed_seq;
+	vmdb_set_seq(&_vmdb[0], _vm.committed_seq, _vm.pending_seq);
+	vmdb_set_last(&_vmdb[0], _vm.seqlast);
+	dev.Write(&_vmdb[0], 1, _vmdb_sect);
+	dev.Sync();
 
-	dev.Write(sect, 1, vol.vblk_sect);
+	_staged.clear();
+	_where.clear();
 }
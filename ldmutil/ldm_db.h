@@ -1,8 +1,7 @@
 #ifndef __LDM_DB_H__
 #define __LDM_DB_H__
 
-#include <map>
-#include <list>
+#include <vector>
 #include <cstdio>
 
 #include "types.h"
@@ -13,42 +12,89 @@ namespace ldm {
 
 class Volume {
 public:
-	u32 id;
-	u32 vblk_sect;
+	u64 id;
+	u64 vblk_sect;
 	u8 vblk_subsect;
 	u8 type;
-	u8 toffset;
 public:
 	Volume(void) {id = 0; type = 0;}
 };
 
 class Partition {
 public:
-	u32 id;
-	u32 p_id;
-	Volume* vol;
-	u32 start;
-	u32 size;
+	u64 id;
+	u64 p_id;
+	u64 disk_id;
+	const Volume* vol;
+	u64 start;
+	u64 size;
 public:
-	bool operator < (const Partition& p) const {return (start < p.start);}
+	bool operator < (const Partition& p) const {
+		if (disk_id != p.disk_id)
+			return (disk_id < p.disk_id);
+		return (start < p.start);
+	}
 };
 
 class Disk {
 public:
-	Disk(void) {name[0] = '\0';}
-	u32 id;
+	Disk(void) {name[0] = '\0'; first = last = 0;}
+	u64 id;
 	char name[LDM_VBLK_MAX_NAME];
-	std::list<Partition> partlist;
+	u32 first;		// this disk's partitions are
+	u32 last;		// _parts[first] .. _parts[last-1]
 };
 
+struct Component {
+	u64 id;
+	u64 p_id;
+};
+
+// A change waiting to be written by Commit().
+struct Edit {
+	u64 sect;
+	u8 subsect;
+	u8 type;
+	bool operator < (const Edit& e) const {return (sect < e.sect);}
+};
+
+// Everything is kept in flat vectors, sorted by id (partitions by disk,
+// then start) once the database has been read.  Lookups are binary searches.
 class ldmdb_c {
 private:
-	std::map<u32, Volume> _volmap;
-	std::map<u32, Disk> _diskmap;
+	std::vector<Volume> _vols;
+	std::vector<Disk> _disks;
+	std::vector<Partition> _parts;
+	Volume _novol;		// for partitions without a volume
+	privhead_t _ph;
+	vmdb_t _vm;
+	u64 _vmdb_sect;
+	std::vector<u8> _vblks;		// raw VBLK sectors, to compare copies
+	std::vector<Edit> _edits;
+	std::vector<u8> _staged;	// sectors ready to write
+	std::vector<u64> _where;	// and where they go
+	std::vector<u8> _vmdb;
+	void ReadVmdb(diskio& dev);
+	void StageSector(const u8* sect, u64 where);
 public:
 	void Read(diskio& dev);
 	void Dump(std::ostream& s);
-	void ChangeVolType(diskio& dev, u32 vblkid, u8 type);
+	void ChangeVolType(diskio& dev, u64 vblkid, u8 type);
+	void SetVolType(u64 vblkid, u8 type);
+	int Commit(diskio& dev);
+	int Compact(diskio& dev);
+
+	// The steps of Commit(), so that the copies of the database on all
+	// the disks of a group can be kept in step
+	int Stage(diskio& dev);
+	int Staged(void) const {return _where.size();}
+	void WritePending(diskio& dev);
+	void WriteStaged(diskio& dev);
+	void WriteCommitted(diskio& dev);
+
+	bool SameDatabase(const ldmdb_c& db) const;
+	const char* DiskId(void) const {return _ph.disk_id;}
+	u32 Slots(void) const {return _vm.seqlast;}
 };
 
 }
@@ -0,0 +1,174 @@
+/**
+ * ldmutil - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Jakob Kemi <jakob.kemi@telia.com>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <vector>
+#include <cstring>
+#include <pthread.h>
+
+#include "types.h"
+#include "error.h"
+#include "ldm_db.h"
+#include "ldm_group.h"
+
+using namespace std;
+using namespace ldm;
+
+struct _job_t {
+	void (*step)(diskio& dev, ldmdb_c& db);
+	diskio* dev;
+	ldmdb_c* db;
+	Error* err;
+};
+
+static void* _run(void* arg)
+{
+	_job_t* job = (_job_t*)arg;
+
+	try {
+		job->step(*job->dev, *job->db);
+	}
+	catch (Error& e) {
+		job->err = new Error(e);
+	}
+	catch (...) {
+		job->err = new Error(LDM_MKERROR("Unknown error."));
+	}
+	return 0;
+}
+
+static void _read(diskio& dev, ldmdb_c& db)		{ db.Read(dev); }
+static void _stage(diskio& dev, ldmdb_c& db)		{ db.Stage(dev); }
+static void _compact(diskio& dev, ldmdb_c& db)		{ db.Compact(dev); }
+static void _pending(diskio& dev, ldmdb_c& db)		{ db.WritePending(dev); }
+static void _staged(diskio& dev, ldmdb_c& db)		{ db.WriteStaged(dev); }
+static void _committed(diskio& dev, ldmdb_c& db)	{ db.WriteCommitted(dev); }
+
+ldmgroup_c::~ldmgroup_c(void)
+{
+	for (u32 i = 0; i < _dbs.size(); i++)
+		delete _dbs[i];
+}
+
+// Run one step on every disk at once, and wait for them all.  If any of
+// them failed, throw the first error.
+void ldmgroup_c::Parallel(step_t step)
+{
+	u32 n = _devs.size();
+	vector<_job_t> jobs(n);
+	vector<pthread_t> threads(n);
+	vector<bool> started(n);
+	u32 i;
+
+	for (i = 0; i < n; i++) {
+		jobs[i].step = step;
+		jobs[i].dev = _devs[i];
+		jobs[i].db = _dbs[i];
+		jobs[i].err = 0;
+		started[i] = (pthread_create(&threads[i], 0, _run, &jobs[i]) == 0);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (started[i])
+			pthread_join(threads[i], 0);
+		else
+			_run(&jobs[i]);
+	}
+
+	Error* err = 0;
+	for (i = 0; i < n; i++) {
+		if (!err)
+			err = jobs[i].err;
+		else
+			delete jobs[i].err;
+	}
+	if (err) {
+		Error e(*err);
+		delete err;
+		throw e;
+	}
+}
+
+void ldmgroup_c::Read(vector<diskio*>& devs)
+{
+	u32 i, j;
+
+	_devs = devs;
+	for (i = 0; i < _devs.size(); i++)
+		_dbs.push_back(new ldmdb_c);
+
+	Parallel(_read);
+
+	for (i = 1; i < _dbs.size(); i++)
+		if (!_dbs[0]->SameDatabase(*_dbs[i]))
+			throw LDM_MKERROR("The disks don't hold the same database.");
+
+	for (i = 0; i < _dbs.size(); i++)
+		for (j = i + 1; j < _dbs.size(); j++)
+			if (strcmp(_dbs[i]->DiskId(), _dbs[j]->DiskId()) == 0)
+				throw LDM_MKERROR("The same disk is given twice.");
+}
+
+void ldmgroup_c::SetVolType(u64 id, u8 type)
+{
+	for (u32 i = 0; i < _dbs.size(); i++)
+		_dbs[i]->SetVolType(id, type);
+}
+
+// Commit the pending changes to every disk.  The steps are:
+//
+//	stage		read and check every sector to change
+//	pending		mark each VMDB as being changed, and sync
+//	staged		write the VBLKs, and sync
+//	committed	mark each VMDB as finished, and sync
+//
+// Nothing is written unless every disk got through staging.  After a
+// crash in the middle, the copies are either all unchanged, or the VMDBs
+// say a change was being made: pending is ahead of committed.  No copy
+// says it's committed until all the VBLKs on every disk are written.
+//
+// Returns the number of VBLK sectors changed on each disk.
+int ldmgroup_c::Commit(void)
+{
+	Parallel(_stage);
+	return Write();
+}
+
+// Pack the database on every disk, and write it the same way as Commit().
+// The copies are the same, so they're packed the same.
+int ldmgroup_c::Compact(void)
+{
+	Parallel(_compact);
+	return Write();
+}
+
+int ldmgroup_c::Write(void)
+{
+	int n = _dbs[0]->Staged();
+	if (n == 0)
+		return 0;
+
+	Parallel(_pending);
+	Parallel(_staged);
+	Parallel(_committed);
+	return n;
+}
@@ -0,0 +1,36 @@
+#ifndef __LDM_GROUP_H__
+#define __LDM_GROUP_H__
+
+#include <vector>
+
+#include "types.h"
+#include "diskio.h"
+#include "ldm_db.h"
+
+namespace ldm {
+
+// Every disk in a group holds a copy of the database, and the copies have
+// to agree.  This reads the copies on a set of disks, checks they really
+// are copies, and commits each change to all of them at once.  Each step
+// runs on all the disks in parallel, and a step doesn't start until the
+// previous one is on every disk.
+class ldmgroup_c {
+private:
+	std::vector<diskio*> _devs;
+	std::vector<ldmdb_c*> _dbs;
+	typedef void (*step_t)(diskio& dev, ldmdb_c& db);
+	void Parallel(step_t step);
+	int Write(void);
+public:
+	~ldmgroup_c(void);
+	void Read(std::vector<diskio*>& devs);
+	void SetVolType(u64 vblkid, u8 type);
+	int Commit(void);
+	int Compact(void);
+	u32 Slots(void) const {return _dbs[0]->Slots();}
+	int Size(void) const {return _devs.size();}
+};
+
+}
+
+#endif
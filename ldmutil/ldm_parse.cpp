@@ -27,13 +27,14 @@
 #include "types.h"
 #include "endian.h"
 #include "ldm_parse.h"
+#include "guid.h"
+#include "vblk_view.h"
 
 using namespace ldm;
 
 static const u64 _SIGN_PRIVHEAD = 0x5052495648454144ULL;	// "PRIVHEAD"
 static const u64 _SIGN_TOCBLOCK = 0x544F43424C4F434BULL;	// "TOCBLOCK"
 static const u32 _SIGN_VMDB = 0x564D4442UL;			// "VMDB"
-static const u32 _SIGN_VBLK = 0x56424C4BUL;			// "VBLK"
 
 #pragma pack(1)
 
@@ -102,66 +103,24 @@ struct _raw_vmdb_t {
 	u8	padding[512-193];
 };
 
-struct _raw_vblk_t {
-	u32	signature;
-	u32	vmdb_seq;
-	u32	grpnum;
-	u16	record;			// x of y
-	u16	nrecords;
-	u8	padding[128-16];
-};
-
 #pragma pack()
 
 
-//***************************************************************************
-static u64 _v_get_num(const void* ptr);
-static int _v_get_str(const void* ptr, char* buf, const int bufsize);
-static int _v_get_size(const void* ptr);
-static bool _guid_to_string(char* dest, const u8* guid);
-
-
-static u64 _v_get_num(const void* ptr)
-{
-	const u8* data = (u8*)ptr;
-	u64 t = 0;
-	int len = *data++;
-
-	while (len--)
-		t = (t << 8) | *data++;
-
-	return t;
-}
-
-static int _v_get_str(const void* ptr, char* buf, const int bufsize)
-{
-	const u8* data = (u8*)ptr;
-	int len;
-
-	len = *data++;
-
-	if (len >= bufsize)
-		len = bufsize - 1;
-
-	memcpy (buf, data, len);
-	buf[len] = (u8)'\0';
-	return len;
-}
-
-static int _v_get_size(const void* ptr)
+// Copy a zero padded GUID, in the one form that guid_format() makes, so
+// that copies from different disks compare equal whatever their case.
+// Returns false, copying the text as it is, if it isn't a GUID.
+static bool _guid_copy(char* dest, const u8* raw)
 {
-	const u8* data = (u8*)ptr;
-	return *data + 1;
-}
+	u8 guid[16];
 
+	if (raw[GUID_TEXT_LEN] == '\0' && guid_parse((const char*)raw, guid)) {
+		guid_format(guid, dest);
+		return true;
+	}
 
-static bool _guid_to_string(char* dest, const u8* guid)
-{
-	sprintf(dest, "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
-		guid[ 0], guid[ 1], guid[ 2], guid[ 3], guid[ 4], guid[ 5], guid[ 6], guid[ 7],
-		guid[ 8], guid[ 9], guid[10], guid[11], guid[12], guid[13], guid[14], guid[15]
-	);
-	return true;
+	strncpy(dest, (const char*)raw, 63);
+	dest[63] = '\0';
+	return false;
 }
 
 //***************************************************************************
@@ -175,11 +134,10 @@ bool ldm::raw_to_privhead(const void* raw, privhead_t* ph)
 
 	ph->v_major = __be16_to_cpu(rph->ver_major);
 	ph->v_minor = __be16_to_cpu(rph->ver_minor);
-	strncpy(ph->disk_id, (char*)rph->disk_id, 64);
-	ph->disk_id[63] = '\0';
+	if (!_guid_copy(ph->disk_id, rph->disk_id))
+		return false;
 
-	strncpy(ph->dgrp_id, (char*)rph->diskgroup_id, 64);
-	ph->dgrp_id[63] = '\0';
+	_guid_copy(ph->dgrp_id, rph->diskgroup_id);
 
 	ph->disk_start = __be64_to_cpu(rph->logical_disk_start);
 	ph->disk_size = __be64_to_cpu(rph->logical_disk_size);
@@ -204,6 +162,7 @@ bool ldm::raw_to_tocblock(const void* raw, tocblock_t* tb)
 		return false;
 
 	tb->bitmap1_start = __be64_to_cpu(rtb->bitmap1_start);
+	tb->bitmap1_size = __be64_to_cpu(rtb->bitmap1_size);
 
 	return true;
 }
@@ -220,76 +179,96 @@ bool ldm::raw_to_vmdb(const void* raw, vmdb_t* vmdb)
 	vmdb->v_major = __be16_to_cpu(rvmdb->ver_major);
 	vmdb->v_minor = __be16_to_cpu(rvmdb->ver_minor);
 
-	strncpy(vmdb->dg_guid, (char*)rvmdb->dg_guid, 64);
+	_guid_copy(vmdb->dg_guid, rvmdb->dg_guid);
+	vmdb->committed_seq = __be64_to_cpu(rvmdb->committed_seq);
+	vmdb->pending_seq = __be64_to_cpu(rvmdb->pending_seq);
 
 	return true;
 }
 
 
-bool ldm::raw_to_vblk(const void* raw, vblk_t* vblk)
+// A change is started by moving the pending sequence number on, and
+// finished by bringing the committed one up to it.
+bool ldm::vmdb_set_seq(void* raw, u64 committed, u64 pending)
 {
-	_raw_vblk_t* rvblk = (_raw_vblk_t*)raw;
-	if (__be32_to_cpu(rvblk->signature) != _SIGN_VBLK )
+	_raw_vmdb_t* rvmdb = (_raw_vmdb_t*)raw;
+	if (__be32_to_cpu(rvmdb->signature) != _SIGN_VMDB)
 		return false;
 
-	vblk->vmdb_seq = __be32_to_cpu(rvblk->vmdb_seq);
-	vblk->record = __be16_to_cpu(rvblk->record);
-	vblk->nrecords = __be16_to_cpu(rvblk->nrecords);
+	rvmdb->committed_seq = __cpu_to_be64(committed);
+	rvmdb->pending_seq = __cpu_to_be64(pending);
+
+	return true;
+}
+
 
-	// FIXME, this is ugly
-//	if (vblk->nrecords != 1)
-//		return false;
-	if (vblk->record != 0)
+// The last VBLK's sequence number is also the number of slots, counting the
+// VMDB's.  It has to match the size of the "config" bitmap in the TOCBLOCKs.
+bool ldm::vmdb_set_last(void* raw, u32 seqlast)
+{
+	_raw_vmdb_t* rvmdb = (_raw_vmdb_t*)raw;
+	if (__be32_to_cpu(rvmdb->signature) != _SIGN_VMDB)
 		return false;
 
-	u8* ptr = (u8*)rvblk->padding;
+	rvmdb->seq = __cpu_to_be32(seqlast);
 
-	vblk->recordtype = __be32_to_cpup((u32*)ptr) & 0xff;
-	ptr += 4;
+	return true;
+}
 
-	ptr += 4;
 
-	vblk->objectid = _v_get_num(ptr);
-	ptr += _v_get_size(ptr);
+// Size in sectors of the "config" bitmap: the VMDB and the VBLKs.
+bool ldm::tocblock_set_config_size(void* raw, u64 size)
+{
+	_raw_tocblock_t* rtb = (_raw_tocblock_t*)raw;
+	if (__be64_to_cpu(rtb->signature) != _SIGN_TOCBLOCK ||
+	    strncmp((char*)rtb->bitmap1_name, "config", sizeof(rtb->bitmap1_name)) != 0)
+		return false;
+
+	rtb->bitmap1_size = __cpu_to_be64(size);
+
+	return true;
+}
+
+
+bool ldm::raw_to_vblk(const void* raw, vblk_t* vblk)
+{
+	vblk_view vb((void*)raw);
+	if (!vb.valid())
+		return false;
 
-	_v_get_str(ptr, vblk->objname, LDM_VBLK_MAX_NAME);
-	ptr += _v_get_size(ptr);
+	vblk->vmdb_seq = vb.vmdb_seq();
+	vblk->record = vb.record();
+	vblk->nrecords = vb.nrecords();
+	vblk->recordtype = vb.type();
+	vblk->objectid = vb.objectid();
+	vb.name(vblk->objname, LDM_VBLK_MAX_NAME);
 
 	switch (vblk->recordtype)
 	{
 	case LDM_VBLK_COMPONENT:
-		ptr += _v_get_size(ptr);
-		ptr += 23;
-		vblk->component.parentid = _v_get_num(ptr);
-		ptr += _v_get_size(ptr);
+		{
+			component_view c((void*)raw);
+			vblk->component.parentid = c.parentid();
+		}
 		break;
 
 	case LDM_VBLK_PARTITION:
-		ptr += 12;
-		vblk->partition.start = __be64_to_cpup((u64*)ptr);
-		ptr += 8;
-		vblk->partition.offset = __be64_to_cpup((u64*)ptr);
-		ptr += 8;
-		vblk->partition.size = _v_get_num(ptr);
-		ptr += _v_get_size(ptr);
-		vblk->partition.parentid = _v_get_num(ptr);
-		ptr += _v_get_size(ptr);
-		vblk->partition.diskid = _v_get_num(ptr);
-		ptr += _v_get_size(ptr);
+		{
+			partition_view p((void*)raw);
+			vblk->partition.start = p.start();
+			vblk->partition.offset = p.offset();
+			vblk->partition.size = p.size();
+			vblk->partition.parentid = p.parentid();
+			vblk->partition.diskid = p.diskid();
+		}
 		break;
 
 	case LDM_VBLK_VOLUME:
-		ptr += _v_get_size(ptr);
-		ptr += 1;
-		ptr += 14;
-		ptr += 25;
-		ptr += _v_get_size(ptr);
-		ptr += 4;
-		vblk->volume.type_at_offset = (int) (ptr - (u8*)rvblk);
-		vblk->volume.type = *ptr;
-		ptr += 1;
-		ptr += 16;
-		ptr += _v_get_size(ptr);
+		{
+			volume_view v((void*)raw);
+			vblk->volume.type_at_offset = v.part_type_offset();
+			vblk->volume.type = v.part_type();
+		}
 		break;
 
 	case LDM_VBLK_DISK1:
@@ -6,6 +6,7 @@
 namespace ldm {
 
 #define LDM_VBLK_MAX_NAME		32
+#define LDM_VBLK_SIZE			128
 
 #define LDM_VBLK_COMPONENT		0x32
 #define LDM_VBLK_PARTITION		0x33
@@ -29,7 +30,8 @@ struct privhead_t {
 };
 
 struct tocblock_t {
-	u64 bitmap1_start;
+	u64 bitmap1_start;	// the "config" area: VMDB and VBLKs
+	u64 bitmap1_size;
 };
 
 struct vmdb_t {
@@ -38,6 +40,8 @@ struct vmdb_t {
 	u16 v_major;
 	u16 v_minor;
 	char dg_guid[64];	// disk group id guid
+	u64 committed_seq;	// bumped by every change to the database
+	u64 pending_seq;	// ahead of committed_seq while a change is made
 };
 
 struct vblk_t {
@@ -75,5 +79,9 @@ bool raw_to_tocblock(const void* raw, tocblock_t* tb);
 bool raw_to_vmdb(const void* raw, vmdb_t* vmdb);
 bool raw_to_vblk(const void* raw, vblk_t* vblk);
 
+bool vmdb_set_seq(void* raw, u64 committed, u64 pending);
+bool vmdb_set_last(void* raw, u32 seqlast);
+bool tocblock_set_config_size(void* raw, u64 size);
+
 }	// namespace ldm
 #endif
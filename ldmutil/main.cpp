@@ -23,8 +23,13 @@
 
 #include <iostream>
 #include <iomanip>
+#include <vector>
+#include <cstdio>
+#include <cstring>
 #include "error.h"
 #include "ldm_db.h"
+#include "ldm_group.h"
+#include "iolimit.h"
 
 using namespace std;
 using namespace ldm;
@@ -36,6 +41,15 @@ static void _display_usage(int argc, char** argv)
 	cerr << "   " << argv[0] << " DEVICE l            -- list partitions to stdout\n";
 	cerr << "   " << argv[0] << " DEVICE c DEVICE2    -- copy raw ldm database from DEVICE to DEVICE2\n";
 	cerr << "   " << argv[0] << " DEVICE t VOLID TYPE -- set partition type for VOLID to TYPE\n";
+	cerr << "   " << argv[0] << " DEVICE b SCRIPT [DEVICE2 ...]\n";
+	cerr << "                                 -- make all the changes in SCRIPT (- for stdin)\n";
+	cerr << "                                    to the database on every DEVICE of a group\n";
+	cerr << "   " << argv[0] << " DEVICE p [DEVICE2 ...]\n";
+	cerr << "                                 -- pack the database on every DEVICE of a group\n";
+	cerr << "options, before DEVICE:\n";
+	cerr << "   --iops=N            -- do at most N I/Os a second\n";
+	cerr << "   --bw=BYTES          -- transfer at most BYTES a second\n";
+	cerr << "   --ioclass=CLASS     -- idle or best-effort I/O priority\n";
 	cerr << "   (see README for further information.)\n\n";
 }
 
@@ -90,11 +104,11 @@ static void _task_copy(ldm::diskio& dev, int argc, char** argv)
 static void _task_change(ldm::diskio& dev, int argc, char** argv)
 {
 	ldmdb_c ldm;
-	unsigned long id;
+	unsigned long long id;
 	int type;
 
 	if (
-		argc != 2 || sscanf(argv[0], "%lu", &id) != 1 ||
+		argc != 2 || sscanf(argv[0], "%llu", &id) != 1 ||
 		sscanf(argv[1], "%x", &type) != 1
 	)
 		throw LDM_MKERROR("Invalid parameters.");
@@ -103,6 +117,87 @@ static void _task_change(ldm::diskio& dev, int argc, char** argv)
 	ldm.ChangeVolType(dev, id, type);
 }
 
+// Each line of the script is a command, as it would follow DEVICE on the
+// command line.  Blank lines and lines starting with '#' are ignored.
+// Only "t VOLID TYPE" is allowed so far.  The whole script is checked
+// before the database is touched.
+//
+// Any more devices are other disks of the same group.  They must all hold
+// the same database, and the changes are made to all of them together.
+static void _task_batch(ldm::diskio& dev, int argc, char** argv)
+{
+	ldmgroup_c group;
+	std::vector<ldm::diskio*> devs;
+	std::vector<ldm::diskio> others(argc > 1 ? argc - 1 : 0);
+	std::vector<unsigned long long> ids;
+	std::vector<int> types;
+	char line[256];
+	FILE* f;
+
+	if (argc < 1)
+		throw LDM_MKERROR("Bad argument count.");
+
+	if (strcmp(argv[0], "-") == 0)
+		f = stdin;
+	else if ((f = fopen(argv[0], "r")) == 0)
+		throw LDM_MKERROR("Can't open script.");
+
+	for (int n = 1; fgets(line, sizeof(line), f); n++) {
+		unsigned long long id;
+		int type;
+		char cmd[2], extra;
+		int args = sscanf(line, " %1s %llu %x %c", cmd, &id, &type, &extra);
+
+		if (args <= 0 || cmd[0] == '#')
+			continue;
+		if (cmd[0] != 't' || args != 3 || type < 0 || type > 0xff) {
+			cerr << argv[0] << ":" << n << ": " << line;
+			if (f != stdin)
+				fclose(f);
+			throw LDM_MKERROR("Invalid line in script.");
+		}
+		ids.push_back(id);
+		types.push_back(type);
+	}
+	if (f != stdin)
+		fclose(f);
+
+	devs.push_back(&dev);
+	for (unsigned int i = 0; i < others.size(); i++) {
+		others[i].Open(argv[i + 1], false);
+		devs.push_back(&others[i]);
+	}
+
+	group.Read(devs);
+	for (unsigned int i = 0; i < ids.size(); i++)
+		group.SetVolType(ids[i], types[i]);
+
+	int n = group.Commit();
+	cout << ids.size() << " changes, " << n << " sectors changed on ";
+	cout << group.Size() << " disk(s).\n";
+}
+
+// Pack the database, on this disk and any others of the same group.
+static void _task_pack(ldm::diskio& dev, int argc, char** argv)
+{
+	ldmgroup_c group;
+	std::vector<ldm::diskio*> devs;
+	std::vector<ldm::diskio> others(argc);
+
+	devs.push_back(&dev);
+	for (int i = 0; i < argc; i++) {
+		others[i].Open(argv[i], false);
+		devs.push_back(&others[i]);
+	}
+
+	group.Read(devs);
+	u32 before = group.Slots();
+
+	int n = group.Compact();
+	cout << "VBLK slots " << before << " -> " << group.Slots() << ", ";
+	cout << n << " sectors changed on " << group.Size() << " disk(s).\n";
+}
+
 int main(int argc, char** argv)
 {
 	ldm::diskio dev;
@@ -110,20 +205,44 @@ int main(int argc, char** argv)
 		{'l', &_task_dump, true},
 		{'c', &_task_copy, true},
 		{'t', &_task_change, false},
+		{'b', &_task_batch, false},
+		{'p', &_task_pack, false},
 		{'\0', 0, 0}
 	};
+	u32 iops = 0;
+	u64 bw = 0;
+	const char* ioclass = 0;
 
+	// Options come before the device
+	while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+		if (sscanf(argv[1], "--iops=%u", &iops) == 1 ||
+		    sscanf(argv[1], "--bw=%llu", &bw) == 1)
+			;
+		else if (strncmp(argv[1], "--ioclass=", 10) == 0)
+			ioclass = argv[1] + 10;
+		else {
+			_display_usage(argc, argv);
+			return 1;
+		}
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
 
 	if (argc < 3) {
 		_display_usage(argc, argv);
 		return 1;
 	}
 
+	io_limit(iops, bw);
+
 	for (cmd_parse_t* cp = tasks; cp->taskfunc != 0; cp++) {
 		if (argv[2][0] != cp->flag)
 			continue;
 
 		try {
+			if (ioclass)
+				io_set_class(ioclass);
 			dev.Open(argv[1], cp->readonly);
 			cp->taskfunc(dev, argc - 3, argv + 3);
 		}
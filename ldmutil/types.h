@@ -7,6 +7,7 @@
 #define __be32_to_cpu be32_to_cpu
 #define __be32_to_cpup(x) ( (u32) be32_to_cpu( (u32 *)x))
 #define __be64_to_cpu be64_to_cpu
+#define __cpu_to_be64 be64_to_cpu
 #define lseek64 lseek
 #include <asm/types.h>
 
@@ -38,6 +39,7 @@ typedef __u8	u8;
 typedef __u16	u16;
 typedef __u32	u32;
 typedef __u64	u64;
+typedef __s64	s64;
 
 };
 
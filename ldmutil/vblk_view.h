@@ -0,0 +1,245 @@
+#ifndef __LDM_VBLK_VIEW_H__
+#define __LDM_VBLK_VIEW_H__
+
+#include <cstring>
+
+#include "types.h"
+#include "endian.h"
+#include "ldm_parse.h"
+
+namespace ldm {
+
+// Views over a VBLK where it lies in a sector buffer.  Nothing is copied:
+// each accessor finds its field and decodes it when it's called.  A view
+// doesn't own the buffer, which must outlive it.
+//
+// Most fields don't have a fixed offset, because they follow variable length
+// numbers and strings.  The layout of each record type is a list of fields,
+// given as a type, so the compiler can turn the search for a field into a
+// few additions.
+
+//***************************************************************************
+// Field kinds.  size() is the space the field takes up at p.
+
+template <int N>
+struct fixed {
+	static int size(const u8*) { return N; }
+};
+
+struct var {				// Length byte, then that many bytes
+	static int size(const u8* p) { return *p + 1; }
+};
+
+struct fields_end {};
+
+template <class Kind, class Next = fields_end>
+struct fields {};
+
+// Find field N of a layout starting at p.  Returns 0 if the field doesn't
+// fit before end.
+template <class Layout, int N>
+struct field_at;
+
+template <class Kind, class Next, int N>
+struct field_at<fields<Kind, Next>, N> {
+	static const u8* find(const u8* p, const u8* end) {
+		if (p >= end)
+			return 0;
+		return field_at<Next, N - 1>::find(p + Kind::size(p), end);
+	}
+};
+
+template <class Kind, class Next>
+struct field_at<fields<Kind, Next>, 0> {
+	static const u8* find(const u8* p, const u8* end) {
+		if (p >= end || p + Kind::size(p) > end)
+			return 0;
+		return p;
+	}
+};
+
+//***************************************************************************
+// Decoders for the raw fields.
+
+// One load and a mask, as ldm_get_vnum() in ldm.c explains.
+inline u64 vblk_get_num(const u8* data)
+{
+	unsigned int len = *data;
+	u64 t;
+
+	if (len - 1 >= 8)
+		return 0;
+
+	memcpy(&t, data + len - 7, sizeof(t));
+	return __be64_to_cpu(t) & (~0ULL >> (64 - 8 * len));
+}
+
+inline int vblk_get_str(const u8* data, char* buf, int bufsize)
+{
+	int len = *data++;
+
+	if (len >= bufsize)
+		len = bufsize - 1;
+
+	memcpy(buf, data, len);
+	buf[len] = '\0';
+	return len;
+}
+
+inline u64 vblk_get_be64(const u8* data)
+{
+	u64 t;
+
+	memcpy(&t, data, sizeof(t));
+	return __be64_to_cpu(t);
+}
+
+//***************************************************************************
+// The common header.
+
+class vblk_view {
+protected:
+	u8* _raw;
+
+	// Every record starts with its object id and name, at 0x18.
+	template <class Body>
+	struct layout {
+		typedef fields<var, fields<var, Body> > type;
+	};
+	typedef layout<fields_end>::type head;
+
+	const u8* start() const { return _raw + 0x18; }
+	const u8* end() const { return _raw + LDM_VBLK_SIZE; }
+
+public:
+	explicit vblk_view(void* raw) : _raw((u8*)raw) {}
+
+	u32 signature() const	{ return __be32_to_cpu(*(u32*)_raw); }
+	u32 vmdb_seq() const	{ return __be32_to_cpu(*(u32*)(_raw + 0x04)); }
+	u16 record() const	{ return __be16_to_cpu(*(u16*)(_raw + 0x0C)); }
+	u16 nrecords() const	{ return __be16_to_cpu(*(u16*)(_raw + 0x0E)); }
+	u8 type() const		{ return _raw[0x13]; }
+
+	// A VBLK we can read in place: the first of its records.  Later
+	// records of a fragmented VBLK have no header of their own.
+	bool valid() const {
+		return signature() == 0x56424C4BUL && record() == 0;	// "VBLK"
+	}
+
+	u64 objectid() const {
+		const u8* p = field_at<head, 0>::find(start(), end());
+		return p ? vblk_get_num(p) : 0;
+	}
+
+	int name(char* buf, int bufsize) const {
+		const u8* p = field_at<head, 1>::find(start(), end());
+		if (!p) {
+			buf[0] = '\0';
+			return 0;
+		}
+		return vblk_get_str(p, buf, bufsize);
+	}
+};
+
+// The fields that follow the header, numbered from 0.
+template <class Body>
+class record_view : public vblk_view {
+protected:
+	typedef typename layout<Body>::type fields_t;
+
+	template <int N>
+	u8* field() const {
+		return (u8*)field_at<fields_t, N + 2>::find(start(), end());
+	}
+
+	template <int N>
+	u64 num() const {
+		const u8* p = field<N>();
+		return p ? vblk_get_num(p) : 0;
+	}
+
+	template <int N>
+	u64 be64() const {
+		const u8* p = field<N>();
+		return p ? vblk_get_be64(p) : 0;
+	}
+
+	template <int N>
+	u8 byte() const {
+		const u8* p = field<N>();
+		return p ? *p : 0;
+	}
+
+public:
+	explicit record_view(void* raw) : vblk_view(raw) {}
+};
+
+//***************************************************************************
+// One view per record type.  Fields we don't use are only skipped over.
+
+typedef fields<var,			// 0 state
+	fields<fixed<23>,		// 1
+	fields<var			// 2 parent id
+	> > > component_fields;
+
+class component_view : public record_view<component_fields> {
+public:
+	explicit component_view(void* raw) : record_view<component_fields>(raw) {}
+
+	u64 parentid() const	{ return num<2>(); }
+};
+
+typedef fields<fixed<12>,		// 0
+	fields<fixed<8>,		// 1 start
+	fields<fixed<8>,		// 2 volume offset
+	fields<var,			// 3 size
+	fields<var,			// 4 parent id
+	fields<var			// 5 disk id
+	> > > > > > partition_fields;
+
+class partition_view : public record_view<partition_fields> {
+public:
+	explicit partition_view(void* raw) : record_view<partition_fields>(raw) {}
+
+	u64 start() const	{ return be64<1>(); }
+	u64 offset() const	{ return be64<2>(); }
+	u64 size() const	{ return num<3>(); }
+	u64 parentid() const	{ return num<4>(); }
+	u64 diskid() const	{ return num<5>(); }
+};
+
+typedef fields<var,			// 0 type name
+	fields<fixed<1>,		// 1
+	fields<fixed<14>,		// 2 state
+	fields<fixed<25>,		// 3
+	fields<var,			// 4 size
+	fields<fixed<4>,		// 5
+	fields<fixed<1>,		// 6 partition type
+	fields<fixed<16>,		// 7 volume guid
+	fields<var			// 8
+	> > > > > > > > > volume_fields;
+
+class volume_view : public record_view<volume_fields> {
+public:
+	explicit volume_view(void* raw) : record_view<volume_fields>(raw) {}
+
+	u8 part_type() const	{ return byte<6>(); }
+
+	// Offset of the partition type from the start of the VBLK, or -1.
+	int part_type_offset() const {
+		const u8* p = field<6>();
+		return p ? (int)(p - _raw) : -1;
+	}
+
+	// Change the partition type in the buffer.
+	bool set_part_type(u8 t) {
+		u8* p = field<6>();
+		if (!p)
+			return false;
+		*p = t;
+		return true;
+	}
+};
+
+}	// namespace ldm
+#endif
@@ -23,14 +23,24 @@
  * Boston, MA  02111-1307  USA
  */
 
+#include <linux/version.h>
 #include <linux/slab.h>
+#include <linux/pagemap.h>
 #include <linux/stringify.h>
+#include <linux/init.h>
+#include <asm/semaphore.h>
 #include "ldm.h"
 #include "check.h"
 #include "msdos.h"
 
 #ifdef CONFIG_LDM_EXPORT_SYMBOLS
 #   define static
+int (*ldm_get_vblks_hook) (struct block_device *bdev, unsigned long base,
+			   struct ldmdb *ldb);
+void (*ldm_readahead_hook) (struct block_device *bdev, unsigned long base,
+			    const int *off, int count);
+void (*ldm_read_copies_hook) (struct block_device *bdev, unsigned long base,
+			      const int *off, int count, u8 *buf, int *state);
 #endif
 
 #ifdef CONFIG_BLK_DEV_MD
@@ -69,7 +79,7 @@ __attribute__ ((format (printf, 3, 4)))
 static void _ldm_printk (const char *level, const char *function,
 			 const char *fmt, ...)
 {
-	static char buf[128];
+	char buf[128];
 	va_list args;
 
 	va_start (args, fmt);
@@ -80,6 +90,18 @@ static void _ldm_printk (const char *level, const char *function,
 }
 
 
+/*
+ * Value of each ASCII hex digit, or -1 for any other character.  A lookup
+ * per character is cheaper than the three range checks it replaces.
+ */
+static const signed char ldm_hex[256] = {
+	[0 ... 255] = -1,
+	['0'] =  0, ['1'] =  1, ['2'] =  2, ['3'] =  3, ['4'] =  4,
+	['5'] =  5, ['6'] =  6, ['7'] =  7, ['8'] =  8, ['9'] =  9,
+	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+	['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
 /**
  * ldm_parse_hexbyte - Convert a ASCII hex number to a byte
  * @src:  Pointer to at least 2 characters to convert.
@@ -89,23 +111,15 @@ static void _ldm_printk (const char *level, const char *function,
  * Return:  0-255  Success, the byte was parsed correctly
  *          -1     Error, an invalid character was supplied
  */
-static int ldm_parse_hexbyte (const u8 *src)
+static inline int ldm_parse_hexbyte (const u8 *src)
 {
-	unsigned int x;		/* For correct wrapping */
-	int h;
-
-	/* high part */
-	if      ((x = src[0] - '0') <= '9'-'0') h = x;
-	else if ((x = src[0] - 'a') <= 'f'-'a') h = x+10;
-	else if ((x = src[0] - 'A') <= 'F'-'A') h = x+10;
-	else return -1;
-	h <<= 4;
-
-	/* low part */
-	if ((x = src[1] - '0') <= '9'-'0') return h | x;
-	if ((x = src[1] - 'a') <= 'f'-'a') return h | (x+10);
-	if ((x = src[1] - 'A') <= 'F'-'A') return h | (x+10);
-	return -1;
+	int h = ldm_hex[src[0]];
+	int l = ldm_hex[src[1]];
+
+	if ((h | l) < 0)
+		return -1;
+
+	return (h << 4) | l;
 }
 
 /**
@@ -176,8 +190,10 @@ static BOOL ldm_parse_privhead (const u8 *data, struct privhead *ph)
 			"be %llu bytes.", LDM_DB_SIZE,
 			(unsigned long long)ph->config_size );
 	}
+	/* The database follows the disk, except on GPT disks */
 	if ((ph->logical_disk_size == 0) ||
-	    (ph->logical_disk_start + ph->logical_disk_size > ph->config_start)) {
+	    ((ph->logical_disk_start < ph->config_start + ph->config_size) &&
+	     (ph->config_start < ph->logical_disk_start + ph->logical_disk_size))) {
 		ldm_error ("PRIVHEAD disk size doesn't match real disk size");
 		return FALSE;
 	}
@@ -273,6 +289,10 @@ static BOOL ldm_parse_vmdb (const u8 *data, struct vmdb *vm)
 	vm->vblk_size     = BE32 (data + 0x08);
 	vm->vblk_offset   = BE32 (data + 0x0C);
 	vm->last_vblk_seq = BE32 (data + 0x04);
+	vm->committed_seq = BE64 (data + 0x75);
+
+	memcpy (vm->dg_id, data + 0x35, sizeof (vm->dg_id));
+	vm->dg_id[sizeof (vm->dg_id) - 1] = 0;
 
 	ldm_debug ("Parsed VMDB successfully.");
 	return TRUE;
@@ -329,60 +349,168 @@ static BOOL ldm_compare_tocblocks (const struct tocblock *toc1,
 			sizeof (toc1->bitmap2_name)));
 }
 
+/*
+ * The sectors holding the headers, in two groups.  The first can be read
+ * straight away.  The second is relative to the start of the database, which
+ * the first PRIVHEAD tells us.
+ */
+static const int ldm_probe_head[]   = { 0, OFF_PRIV1 };
+static const int ldm_probe_config[] = { OFF_TOCB1, OFF_TOCB2, OFF_VMDB,
+					OFF_PRIV2, OFF_TOCB3, OFF_TOCB4,
+					OFF_PRIV3 };
+
+/**
+ * ldm_readahead - Start reading some sectors that will be needed soon
+ * @bdev:   Device holding the LDM Database
+ * @base:   Offset, into @bdev, that @off is relative to
+ * @off:    Offsets of the sectors
+ * @count:  Number of entries in @off
+ *
+ * The headers are read and checked one at a time, but most of them don't
+ * depend on each other.  Starting the reads of a group of them together means
+ * we wait for the disk once per group, rather than once per sector.  Nothing
+ * waits here; read_dev_sector finds the pages in the cache, or on their way.
+ *
+ * Kernels before 2.5.8 don't have do_page_cache_readahead, so there this does
+ * nothing and each header is read when it's checked, as before.
+ */
+static void ldm_readahead (struct block_device *bdev, unsigned long base,
+			   const int *off, int count)
+{
+#ifdef CONFIG_LDM_EXPORT_SYMBOLS
+	if (ldm_readahead_hook)
+		ldm_readahead_hook (bdev, base, off, count);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2,5,8)
+	unsigned long page;
+	unsigned long last = ~0UL;
+	int i;
+
+	for (i = 0; i < count; i++) {	/* @off is in ascending order */
+		page = (base + off[i]) >> (PAGE_CACHE_SHIFT - 9);
+		if (page != last)
+			do_page_cache_readahead (bdev->bd_inode->i_mapping,
+						 NULL, page, 1);
+		last = page;
+	}
+#endif
+}
+
+/**
+ * ldm_read_copies - Read the redundant copies of a header
+ * @bdev:   Device holding the LDM Database
+ * @base:   Offset, into @bdev, that @off is relative to
+ * @off:    Offsets of the copies
+ * @count:  Number of copies
+ * @buf:    Returns the sectors, 512 bytes for each copy
+ * @state:  Returns COPY_OK, COPY_FAILED or COPY_LATE for each copy
+ *
+ * Normally this just reads each copy in turn.  In export mode, the caller may
+ * read them all at once and give up on any that are too slow (COPY_LATE), so
+ * that one bad sector doesn't hold up the whole probe.  The validation then
+ * carries on with the copies that did arrive, if there are enough of them.
+ */
+static void ldm_read_copies (struct block_device *bdev, unsigned long base,
+			     const int *off, int count, u8 *buf, int *state)
+{
+	Sector sect;
+	u8 *data;
+	int i;
+
+#ifdef CONFIG_LDM_EXPORT_SYMBOLS
+	if (ldm_read_copies_hook) {
+		ldm_read_copies_hook (bdev, base, off, count, buf, state);
+		return;
+	}
+#endif
+	for (i = 0; i < count; i++) {
+		data = read_dev_sector (bdev, base + off[i], &sect);
+		if (!data) {
+			state[i] = COPY_FAILED;
+			continue;
+		}
+		memcpy (buf + (i << 9), data, 512);
+		put_dev_sector (sect);
+		state[i] = COPY_OK;
+	}
+}
+
 /**
  * ldm_validate_privheads - Compare the primary privhead with its backups
- * @bdev:  Device holding the LDM Database
- * @ph1:   Memory struct to fill with ph contents
+ * @bdev:   Device holding the LDM Database
+ * @label:  Where the primary privhead is, and the GPT partitions, if any
+ * @ph1:    Memory struct to fill with ph contents
  *
  * Read and compare all three privheads from disk.
  *
  * The privheads on disk show the size and location of the main disk area and
  * the configuration area (the database).  The values are range-checked against
- * @hd, which contains the real size of the disk.
+ * @hd, which contains the real size of the disk, and on a GPT disk, against the
+ * LDM partitions.
  *
  * Return:  TRUE   Success
  *          FALSE  Error
  */
 static BOOL ldm_validate_privheads (struct block_device *bdev,
+				    const struct ldm_label *label,
 				    struct privhead *ph1)
 {
-	static const int off[3] = { OFF_PRIV1, OFF_PRIV2, OFF_PRIV3 };
+	static const int off[2] = { OFF_PRIV2, OFF_PRIV3 };
 	struct privhead *ph[3] = { ph1 };
+	BOOL valid[3] = { TRUE, FALSE, FALSE };
+	int state[2];
 	Sector sect;
 	u8 *data;
+	u8 *buf = NULL;
 	BOOL result = FALSE;
 	long num_sects;
 	int i;
 
 	BUG_ON (!bdev);
+	BUG_ON (!label);
 	BUG_ON (!ph1);
 
 	ph[1] = kmalloc (sizeof (*ph[1]), GFP_KERNEL);
 	ph[2] = kmalloc (sizeof (*ph[2]), GFP_KERNEL);
-	if (!ph[1] || !ph[2]) {
+	buf   = kmalloc (2 << 9, GFP_KERNEL);
+	if (!ph[1] || !ph[2] || !buf) {
 		ldm_crit ("Out of memory.");
 		goto out;
 	}
 
-	/* off[1 & 2] are relative to ph[0]->config_start */
-	ph[0]->config_start = 0;
+	/* The primary tells us where the backups are */
+	data = read_dev_sector (bdev, label->ph1, &sect);
+	if (!data) {
+		ldm_crit ("Disk read failed.");
+		goto out;
+	}
+	result = ldm_parse_privhead (data, ph[0]);
+	put_dev_sector (sect);
+	if (!result) {
+		ldm_error ("Cannot find PRIVHEAD 1."); /* Log again */
+		goto out;
+	}
+	result = FALSE;
 
-	/* Read and parse privheads */
-	for (i = 0; i < 3; i++) {
-		data = read_dev_sector (bdev,
-			ph[0]->config_start + off[i], &sect);
-		if (!data) {
+	ldm_readahead (bdev, ph[0]->config_start, ldm_probe_config,
+		       sizeof (ldm_probe_config) / sizeof (int));
+
+	/* off[] is relative to ph[0]->config_start */
+	ldm_read_copies (bdev, ph[0]->config_start, off, 2, buf, state);
+	for (i = 1; i < 3; i++) {
+		if (state[i-1] == COPY_FAILED) {
 			ldm_crit ("Disk read failed.");
 			goto out;
 		}
-		result = ldm_parse_privhead (data, ph[i]);
-		put_dev_sector (sect);
-		if (!result) {
+		if (state[i-1] == COPY_LATE) {
+			ldm_info ("PRIVHEAD %d is late, carrying on without it.", i+1);
+			continue;
+		}
+		valid[i] = ldm_parse_privhead (buf + ((i-1) << 9), ph[i]);
+		if (!valid[i]) {
 			ldm_error ("Cannot find PRIVHEAD %d.", i+1); /* Log again */
 			if (i < 2)
 				goto out;	/* Already logged */
-			else
-				break;	/* FIXME ignore for now, 3rd PH can fail on odd-sized disks */
+			/* FIXME ignore for now, 3rd PH can fail on odd-sized disks */
 		}
 	}
 
@@ -394,14 +522,39 @@ static BOOL ldm_validate_privheads (struct block_device *bdev,
 		goto out;
 	}
 
-	if ((ph[0]->logical_disk_start > ph[0]->config_start) ||
-	   ((ph[0]->logical_disk_start + ph[0]->logical_disk_size)
+	/* On a GPT disk, the database usually comes first */
+	if (label->gpt) {
+		if ((ph[0]->logical_disk_start <
+		     ph[0]->config_start + ph[0]->config_size) &&
+		    (ph[0]->config_start <
+		     ph[0]->logical_disk_start + ph[0]->logical_disk_size)) {
+			ldm_crit ("Disk and database overlap.");
+			goto out;
+		}
+	} else if ((ph[0]->logical_disk_start > ph[0]->config_start) ||
+		  ((ph[0]->logical_disk_start + ph[0]->logical_disk_size)
 		    > ph[0]->config_start)) {
 		ldm_crit ("Disk and database overlap.");
 		goto out;
 	}
 
-	if (!ldm_compare_privheads (ph[0], ph[1])) {
+	if (label->gpt &&
+	    ((ph[0]->config_start < label->meta_start) ||
+	    ((ph[0]->config_start + ph[0]->config_size) >
+	     (label->meta_start + label->meta_size)))) {
+		ldm_crit ("The database isn't in the LDM metadata partition.");
+		goto out;
+	}
+
+	if (label->gpt && label->data_size &&
+	    ((ph[0]->logical_disk_start < label->data_start) ||
+	    ((ph[0]->logical_disk_start + ph[0]->logical_disk_size) >
+	     (label->data_start + label->data_size)))) {
+		ldm_crit ("The volumes aren't in the LDM data partition.");
+		goto out;
+	}
+
+	if (valid[1] && !ldm_compare_privheads (ph[0], ph[1])) {
 		ldm_crit ("Primary and backup PRIVHEADs don't match.");
 		goto out;
 	}
@@ -410,11 +563,19 @@ static BOOL ldm_validate_privheads (struct block_device *bdev,
 		ldm_crit ("Primary and backup PRIVHEADs don't match.");
 		goto out;
 	}*/
+
+	/* If the second was late, the third will do, but it must match */
+	if (!valid[1] && !(valid[2] && ldm_compare_privheads (ph[0], ph[2]))) {
+		ldm_crit ("No backup PRIVHEAD matches the primary.");
+		goto out;
+	}
+
 	ldm_debug ("Validated PRIVHEADs successfully.");
 	result = TRUE;
 out:
 	kfree (ph[1]);
 	kfree (ph[2]);
+	kfree (buf);
 	return result;
 }
 
@@ -428,6 +589,7 @@ out:
  * @bdev and return the parsed information into @toc1.
  *
  * The offsets and sizes of the configs are range-checked against a privhead.
+ * The VMDB must already have been read, so its size can be checked too.
  *
  * Return:  TRUE   @toc1 contains validated TOCBLOCK info
  *          FALSE  @toc1 contents are undefined
@@ -437,10 +599,12 @@ static BOOL ldm_validate_tocblocks (struct block_device *bdev,
 {
 	static const int off[4] = { OFF_TOCB1, OFF_TOCB2, OFF_TOCB3, OFF_TOCB4};
 	struct tocblock *tb[4];
+	struct tocblock *ref = NULL;
 	struct privhead *ph;
-	Sector sect;
-	u8 *data;
+	int state[4];
+	u8 *buf;
 	BOOL result = FALSE;
+	int count = 0;
 	int i;
 
 	BUG_ON (!bdev);
@@ -451,24 +615,42 @@ static BOOL ldm_validate_tocblocks (struct block_device *bdev,
 	tb[1] = kmalloc (sizeof (*tb[1]), GFP_KERNEL);
 	tb[2] = kmalloc (sizeof (*tb[2]), GFP_KERNEL);
 	tb[3] = kmalloc (sizeof (*tb[3]), GFP_KERNEL);
-	if (!tb[1] || !tb[2] || !tb[3]) {
+	buf   = kmalloc (4 << 9, GFP_KERNEL);
+	if (!tb[1] || !tb[2] || !tb[3] || !buf) {
 		ldm_crit ("Out of memory.");
 		goto out;
 	}
 
-	for (i = 0; i < 4; i++)		/* Read and parse all four toc's. */
+	ldm_read_copies (bdev, base, off, 4, buf, state);
+	for (i = 0; i < 4; i++)		/* Parse all four toc's. */
 	{
-		data = read_dev_sector (bdev, base + off[i], &sect);
-		if (!data) {
+		if (state[i] == COPY_FAILED) {
 			ldm_crit ("Disk read failed.");
 			goto out;
 		}
-		result = ldm_parse_tocblock (data, tb[i]);
-		put_dev_sector (sect);
-		if (!result)
+		if (state[i] == COPY_LATE) {
+			ldm_info ("TOCBLOCK %d is late, carrying on without it.", i+1);
+			continue;
+		}
+		if (!ldm_parse_tocblock (buf + (i << 9), tb[i]))
 			goto out;	/* Already logged */
+
+		if (!ref)
+			ref = tb[i];
+		else if (!ldm_compare_tocblocks (ref, tb[i])) {	/* Compare all tocs. */
+			ldm_crit ("The TOCBLOCKs don't match.");
+			goto out;
+		}
+		count++;
 	}
 
+	if (count < TOC_QUORUM) {
+		ldm_crit ("Only %d TOCBLOCKs arrived in time.", count);
+		goto out;
+	}
+	if (ref != tb[0])
+		memcpy (tb[0], ref, sizeof (*tb[0]));
+
 	/* Range check the toc against a privhead. */
 	if (((tb[0]->bitmap1_start + tb[0]->bitmap1_size) > ph->config_size) ||
 	    ((tb[0]->bitmap2_start + tb[0]->bitmap2_size) > ph->config_size)) {
@@ -476,12 +658,9 @@ static BOOL ldm_validate_tocblocks (struct block_device *bdev,
 		goto out;
 	}
 
-	if (!ldm_compare_tocblocks (tb[0], tb[1]) ||	/* Compare all tocs. */
-	    !ldm_compare_tocblocks (tb[0], tb[2]) ||
-	    !ldm_compare_tocblocks (tb[0], tb[3])) {
-		ldm_crit ("The TOCBLOCKs don't match.");
-		goto out;
-	}
+	/* FIXME: How should we handle this situation? */
+	if ((ldb->vm.vblk_size * ldb->vm.last_vblk_seq) != (tb[0]->bitmap1_size << 9))
+		ldm_info ("VMDB and TOCBLOCK don't agree on the database size.");
 
 	ldm_debug ("Validated TOCBLOCKs successfully.");
 	result = TRUE;
@@ -489,6 +668,7 @@ out:
 	kfree (tb[1]);
 	kfree (tb[2]);
 	kfree (tb[3]);
+	kfree (buf);
 	return result;
 }
 
@@ -511,13 +691,11 @@ static BOOL ldm_validate_vmdb (struct block_device *bdev, unsigned long base,
 	u8 *data;
 	BOOL result = FALSE;
 	struct vmdb *vm;
-	struct tocblock *toc;
 
 	BUG_ON (!bdev);
 	BUG_ON (!ldb);
 
-	vm  = &ldb->vm;
-	toc = &ldb->toc;
+	vm = &ldb->vm;
 
 	data = read_dev_sector (bdev, base + OFF_VMDB, &sect);
 	if (!data) {
@@ -537,10 +715,6 @@ static BOOL ldm_validate_vmdb (struct block_device *bdev, unsigned long base,
 	if (vm->vblk_offset != 512)
 		ldm_info ("VBLKs start at offset 0x%04x.", vm->vblk_offset);
 
-	/* FIXME: How should we handle this situation? */
-	if ((vm->vblk_size * vm->last_vblk_seq) != (toc->bitmap1_size << 9))
-		ldm_info ("VMDB and TOCBLOCK don't agree on the database size.");
-
 	result = TRUE;
 out:
 	put_dev_sector (sect);
@@ -548,14 +722,295 @@ out:
 }
 
 
+/*
+ * Which devices to probe, from the "ldm=" boot option (or ldminfo --probe).
+ * It's a list of device names separated by commas.  A name starting with '!'
+ * is never probed; if there are any other names, only they are probed.  For
+ * example, "ldm=sda,sdb" or "ldm=!sdc,!sdd".
+ */
+static char *ldm_probe_list;
+
+#ifndef CONFIG_LDM_EXPORT_SYMBOLS
+static int __init ldm_setup (char *str)
+{
+	ldm_probe_list = str;
+	return 1;
+}
+
+__setup ("ldm=", ldm_setup);
+#endif
+
+/**
+ * ldm_probe_wanted - Should this device be probed at all?
+ * @name:  Name of the device, e.g. "sda"
+ *
+ * Return:  TRUE   Probe it
+ *          FALSE  The probe list rules it out
+ */
+static BOOL ldm_probe_wanted (const char *name)
+{
+	const char *p = ldm_probe_list;
+	BOOL only = FALSE;
+	BOOL skip;
+	int len;
+
+	if (!p || !name)
+		return TRUE;
+
+	while (*p) {
+		skip = (*p == '!');
+		if (skip)
+			p++;
+		for (len = 0; p[len] && (p[len] != ','); len++)
+			;
+		if ((len == strlen (name)) && (strncmp (p, name, len) == 0))
+			return !skip;
+		if (!skip)
+			only = TRUE;
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+
+	return !only;
+}
+
+/*
+ * Devices that were found not to be dynamic disks.  Each is identified by its
+ * name, its size and a checksum of its first two sectors, which hold the
+ * partition table and the GPT header (whose CRC covers the GPT's entries).
+ * While those don't change, a rescan gets the same answer without parsing the
+ * partition table again.
+ *
+ * Only this first test is remembered.  A dynamic disk with a broken database
+ * is checked in full every time, because it might have been repaired.
+ */
+#define LDM_NEGATIVE		32		/* Devices remembered */
+
+struct ldm_negative {
+	char	name[32];
+	u64	size;
+	u32	sum;
+};
+
+static struct ldm_negative ldm_negative[LDM_NEGATIVE];
+static int ldm_negative_next;			/* Replaced in turn */
+
+#ifdef CONFIG_LDM_EXPORT_SYMBOLS
+#define ldm_negative_lock()	do {} while (0)
+#define ldm_negative_unlock()	do {} while (0)
+#else
+static DECLARE_MUTEX (ldm_negative_sem);
+#define ldm_negative_lock()	down (&ldm_negative_sem)
+#define ldm_negative_unlock()	up (&ldm_negative_sem)
+#endif
+
+/**
+ * ldm_checksum - Add a sector to a simple checksum
+ */
+static u32 ldm_checksum (u32 sum, const u8 *data)
+{
+	int i;
+
+	for (i = 0; i < 512; i += 4)
+		sum = ((sum << 5) | (sum >> 27)) + get_unaligned ((const u32*) (data + i));
+
+	return sum;
+}
+
+/**
+ * ldm_negative_find - Is this device already known not to be a dynamic disk?
+ *
+ * Return:  TRUE   It's in the cache, unchanged
+ *          FALSE  Otherwise
+ */
+static BOOL ldm_negative_find (const char *name, u64 size, u32 sum)
+{
+	struct ldm_negative *n;
+	BOOL result = FALSE;
+	int i;
+
+	ldm_negative_lock();
+	for (i = 0, n = ldm_negative; i < LDM_NEGATIVE; i++, n++) {
+		if (strncmp (n->name, name, sizeof (n->name)) != 0)
+			continue;
+		result = (n->size == size) && (n->sum == sum);
+		break;
+	}
+	ldm_negative_unlock();
+
+	return result;
+}
+
+/**
+ * ldm_negative_add - Remember that a device isn't a dynamic disk
+ */
+static void ldm_negative_add (const char *name, u64 size, u32 sum)
+{
+	struct ldm_negative *n = NULL;
+	int i;
+
+	ldm_negative_lock();
+	for (i = 0; i < LDM_NEGATIVE; i++)	/* Replace an old entry */
+		if (strncmp (ldm_negative[i].name, name, sizeof (n->name)) == 0)
+			n = ldm_negative + i;
+	if (!n) {
+		n = ldm_negative + ldm_negative_next;
+		ldm_negative_next = (ldm_negative_next + 1) % LDM_NEGATIVE;
+	}
+	strncpy (n->name, name, sizeof (n->name) - 1);
+	n->size = size;
+	n->sum  = sum;
+	ldm_negative_unlock();
+}
+
+/* Partition types of a GPT dynamic disk, as they're stored */
+static const u8 ldm_gpt_meta[GUID_SIZE] = {	/* 5808C8AA-7E8F-42E0-85D2-E1E90434CFB3 */
+	0xAA, 0xC8, 0x08, 0x58, 0x8F, 0x7E, 0xE0, 0x42,
+	0x85, 0xD2, 0xE1, 0xE9, 0x04, 0x34, 0xCF, 0xB3 };
+static const u8 ldm_gpt_data[GUID_SIZE] = {	/* AF9B60A0-1431-4F62-BC68-3311714A69AD */
+	0xA0, 0x60, 0x9B, 0xAF, 0x31, 0x14, 0x62, 0x4F,
+	0xBC, 0x68, 0x33, 0x11, 0x71, 0x4A, 0x69, 0xAD };
+
+/**
+ * ldm_crc32 - Continue a CRC-32, as used by the GPT
+ * @crc:  CRC so far, 0 to start
+ * @buf:  Data to add
+ * @len:  Length of @buf
+ *
+ * It's only needed for a few sectors, so a bit at a time will do.
+ */
+static u32 ldm_crc32 (u32 crc, const u8 *buf, int len)
+{
+	int i;
+
+	crc = ~crc;
+	while (len-- > 0) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+/**
+ * ldm_parse_gpt - Find the LDM partitions in a GPT
+ * @bdev:   Device holding the LDM Database
+ * @label:  Returns the location of the LDM partitions
+ *
+ * A GPT dynamic disk keeps the LDM database in an LDM metadata partition, with
+ * the primary PRIVHEAD in its last sector.  The volumes are in an LDM data
+ * partition.  Only the GPT header and its array of entries are read, and both
+ * are checked against their CRCs.
+ *
+ * Return:  1  @bdev is a GPT dynamic disk
+ *          0  @bdev is not a dynamic disk
+ *         -1  An error occurred
+ */
+static int ldm_parse_gpt (struct block_device *bdev, struct ldm_label *label)
+{
+	static const u8 zero[4];
+	Sector sect;
+	u8 *data;
+	u64 entry_lba;
+	u32 hsize, count, esize, ecrc, crc;
+	u32 bytes, n, i;
+	unsigned long s;
+
+	data = read_dev_sector (bdev, OFF_GPT, &sect);
+	if (!data) {
+		ldm_crit ("Disk read failed.");
+		return -1;
+	}
+
+	hsize = LE32 (data + 0x0C);
+	if ((memcmp (data, GPT_SIGNATURE, 8) != 0) ||
+	    (hsize < GPT_HEADER_MIN) || (hsize > 512) ||
+	    (LE64 (data + 0x18) != OFF_GPT)) {
+		ldm_debug ("Found a protective MBR, but no GPT.");
+		put_dev_sector (sect);
+		return 0;
+	}
+
+	crc = ldm_crc32 (0,   data, 0x10);		/* Without its own CRC */
+	crc = ldm_crc32 (crc, zero, 4);
+	crc = ldm_crc32 (crc, data + 0x14, hsize - 0x14);
+
+	entry_lba = LE64 (data + 0x48);
+	count     = LE32 (data + 0x50);
+	esize     = LE32 (data + 0x54);
+	ecrc      = LE32 (data + 0x58);
+	if (crc != LE32 (data + 0x10)) {
+		ldm_error ("The GPT header is corrupt.");
+		put_dev_sector (sect);
+		return -1;
+	}
+	put_dev_sector (sect);
+
+	/* Entries must share sectors evenly */
+	if ((esize < GPT_ENTRY_MIN) || (esize > 512) || (512 % esize) ||
+	    (count > ((GPT_ENTRIES_MAX << 9) / esize))) {
+		ldm_error ("Unsupported GPT, %u entries of %u bytes.", count, esize);
+		return 0;
+	}
+
+	memset (label, 0, sizeof (*label));
+	crc = 0;
+	bytes = count * esize;
+	for (s = 0; bytes > 0; s++) {
+		data = read_dev_sector (bdev, entry_lba + s, &sect);
+		if (!data) {
+			ldm_crit ("Disk read failed.");
+			return -1;
+		}
+		n = min (bytes, 512U);
+		crc = ldm_crc32 (crc, data, n);
+		for (i = 0; i < n; i += esize) {
+			u64 first = LE64 (data + i + 0x20);
+			u64 last  = LE64 (data + i + 0x28);
+
+			if (last < first)
+				continue;
+			if (!label->meta_size &&
+			    !memcmp (data + i, ldm_gpt_meta, GUID_SIZE)) {
+				label->meta_start = first;
+				label->meta_size  = last - first + 1;
+			} else if (!label->data_size &&
+				   !memcmp (data + i, ldm_gpt_data, GUID_SIZE)) {
+				label->data_start = first;
+				label->data_size  = last - first + 1;
+			}
+		}
+		put_dev_sector (sect);
+		bytes -= n;
+	}
+
+	if (crc != ecrc) {
+		ldm_error ("The GPT entries are corrupt.");
+		return -1;
+	}
+
+	if (!label->meta_size) {
+		ldm_debug ("Found a GPT, not a dynamic disk.");
+		return 0;
+	}
+
+	label->gpt = TRUE;
+	label->ph1 = label->meta_start + label->meta_size - 1;
+	ldm_debug ("Parsed GPT successfully.");
+	return 1;
+}
+
 /**
  * ldm_validate_partition_table - Determine whether bdev might be a dynamic disk
- * @bdev:  Device holding the LDM Database
+ * @bdev:   Device holding the LDM Database
+ * @name:   Name of the device, for the cache of negative results, or NULL
+ * @label:  Returns where to look for the LDM Database
  *
  * This function provides a weak test to decide whether the device is a dynamic
  * disk or not.  It looks for an MS-DOS-style partition table containing at
  * least one partition of type 0x42 (formerly SFS, now used by Windows for
- * dynamic disks).
+ * dynamic disks), or a GPT with an LDM metadata partition.
  *
  * N.B.  The only possible error can come from the read_dev_sector and that is
  *       only likely to happen if the underlying device is strange.  If that IS
@@ -564,11 +1019,17 @@ out:
  * Return:  TRUE   @bdev is a dynamic disk
  *          FALSE  @bdev is not a dynamic disk, or an error occurred
  */
-static BOOL ldm_validate_partition_table (struct block_device *bdev)
+static BOOL ldm_validate_partition_table (struct block_device *bdev,
+					  const char *name,
+					  struct ldm_label *label)
 {
 	Sector sect;
+	Sector sect1;
 	u8 *data;
+	u8 *data1;
 	struct partition *p;
+	u64 size = 0;
+	u32 sum = 0;
 	int i;
 	BOOL result = FALSE;
 
@@ -580,11 +1041,29 @@ static BOOL ldm_validate_partition_table (struct block_device *bdev)
 		return FALSE;
 	}
 
+	if (name && *name) {
+		data1 = read_dev_sector (bdev, 1, &sect1);	/* Same page */
+		if (data1) {
+			size = bdev->bd_inode->i_size;
+			sum  = ldm_checksum (ldm_checksum (0, data), data1);
+			put_dev_sector (sect1);
+			if (ldm_negative_find (name, size, sum)) {
+				ldm_debug ("%s is still not a dynamic disk.", name);
+				goto out;
+			}
+		} else {
+			name = NULL;
+		}
+	}
+
 	if (*(u16*) (data + 0x01FE) != cpu_to_le16 (MSDOS_LABEL_MAGIC)) {
 		ldm_debug ("No MS-DOS partition table found.");
-		goto out;
+		goto negative;
 	}
 
+	memset (label, 0, sizeof (*label));
+	label->ph1 = OFF_PRIV1;
+
 	p = (struct partition*)(data + 0x01BE);
 	for (i = 0; i < 4; i++, p++)
 		if (SYS_IND (p) == WIN2K_DYNAMIC_PARTITION) {
@@ -592,10 +1071,25 @@ static BOOL ldm_validate_partition_table (struct block_device *bdev)
 			break;
 		}
 
+	if (!result) {
+		p = (struct partition*)(data + 0x01BE);
+		for (i = 0; i < 4; i++, p++)
+			if (SYS_IND (p) == GPT_PROTECTIVE_PARTITION) {
+				i = ldm_parse_gpt (bdev, label);
+				if (i < 0)
+					goto out;	/* Don't remember errors */
+				result = (i > 0);
+				goto negative;
+			}
+	}
+
 	if (result)
 		ldm_debug ("Parsed partition table successfully.");
 	else
 		ldm_debug ("Found an MS-DOS partition table, not a dynamic disk.");
+negative:
+	if (!result && name && *name)
+		ldm_negative_add (name, size, sum);
 out:
 	put_dev_sector (sect);
 	return result;
@@ -629,7 +1123,8 @@ static struct vblk * ldm_find_vblk (const struct list_head *lh_vl, u64 id)
 
 /**
  * ldm_get_disk_objid - Search a linked list of vblk's for a given Disk Id
- * @ldb:  Cache of the database structures
+ * @ldb:      Cache of the database structures
+ * @disk_id:  GUID of the disk, from its PRIVHEAD
  *
  * The LDM Database contains a list of all partitions on all dynamic disks.  The
  * primary PRIVHEAD, at the beginning of the physical disk, tells us the GUID of
@@ -638,15 +1133,17 @@ static struct vblk * ldm_find_vblk (const struct list_head *lh_vl, u64 id)
  * Return:  Pointer, A matching vblk was found
  *          NULL,    No match, or an error
  */
-static struct vblk * ldm_get_disk_objid (const struct ldmdb *ldb)
+static struct vblk * ldm_get_disk_objid (const struct ldmdb *ldb,
+					 const u8 *disk_id)
 {
 	struct list_head *item;
 
 	BUG_ON (!ldb);
+	BUG_ON (!disk_id);
 
 	list_for_each (item, &ldb->v_disk) {
 		struct vblk *v = list_entry (item, struct vblk, list);
-		if (!memcmp (v->vblk.disk.disk_id, ldb->ph.disk_id, GUID_SIZE))
+		if (!memcmp (v->vblk.disk.disk_id, disk_id, GUID_SIZE))
 			return v;
 	}
 
@@ -656,7 +1153,8 @@ static struct vblk * ldm_get_disk_objid (const struct ldmdb *ldb)
 /**
  * ldm_create_data_partitions - Create data partitions for this device
  * @pp:   List of the partitions parsed so far
- * @ldb:  Cache of the database structures
+ * @ph:   This disk's PRIVHEAD
+ * @ldb:  Cache of the database structures, possibly parsed from another disk
  *
  * The database contains ALL the partitions for ALL disk groups, so we need to
  * filter out this specific disk. Using the disk's object id, we can find all
@@ -672,10 +1170,12 @@ static struct vblk * ldm_get_disk_objid (const struct ldmdb *ldb)
  */
 #ifdef CONFIG_BLK_DEV_MD
 static BOOL ldm_create_data_partitions (struct parsed_partitions *pp,
+					const struct privhead *ph,
 					const struct ldmdb *ldb,
 					struct block_device *bdev)
 #else
 static BOOL ldm_create_data_partitions (struct parsed_partitions *pp,
+					const struct privhead *ph,
 					const struct ldmdb *ldb)
 #endif
 {
@@ -686,9 +1186,10 @@ static BOOL ldm_create_data_partitions (struct parsed_partitions *pp,
 	int part_num = 1;
 
 	BUG_ON (!pp);
+	BUG_ON (!ph);
 	BUG_ON (!ldb);
 
-	disk = ldm_get_disk_objid (ldb);
+	disk = ldm_get_disk_objid (ldb, ph->disk_id);
 	if (!disk) {
 		ldm_crit ("Can't find the ID of this disk in the database.");
 		return FALSE;
@@ -708,7 +1209,7 @@ static BOOL ldm_create_data_partitions (struct parsed_partitions *pp,
 		if (part->disk_id != disk->obj_id)
 			continue;
 
-		put_partition (pp, part_num, ldb->ph.logical_disk_start +
+		put_partition (pp, part_num, ph->logical_disk_start +
 				part->start, part->size);
 #ifdef CONFIG_BLK_DEV_MD
 		/* Try to get parent component */
@@ -780,28 +1281,29 @@ static int ldm_relative (const u8 *buffer, int buflen, int base, int offset)
  * are stored in big-endian byte order.  This function reads one of these
  * numbers and returns the result
  *
- * N.B.  This function DOES NOT perform any range checking, though the most
- *       it will read is eight bytes.
+ * Rather than loop over the bytes, the eight bytes that end with the number are
+ * read in one go and the bytes that precede the number are masked off.
+ *
+ * N.B.  This function DOES NOT perform any range checking.  It reads the eight
+ *       bytes ending at the number, so up to seven bytes BEFORE @block.  The
+ *       numbers are never less than 0x18 bytes into a VBLK, so this is safe.
  *
  * Return:  n A number
  *          0 Zero, or an error occurred
  */
 static u64 ldm_get_vnum (const u8 *block)
 {
-	u64 tmp = 0;
 	u8 length;
 
 	BUG_ON (!block);
 
-	length = *block++;
-
-	if (length && length <= 8)
-		while (length--)
-			tmp = (tmp << 8) | *block++;
-	else
+	length = *block;
+	if ((u8) (length - 1) >= 8) {
 		ldm_error ("Illegal length %d.", length);
+		return 0;
+	}
 
-	return tmp;
+	return BE64 (block + length - 7) & (~0ULL >> (64 - 8 * length));
 }
 
 /**
@@ -1230,37 +1732,53 @@ static BOOL ldm_parse_vblk (const u8 *buf, int len, struct vblk *vb)
 	return result;
 }
 
+/**
+ * ldm_vblk_wanted - Decide whether a type of VBLK needs decoding
+ * @type:  VBLK type, from the record header
+ *
+ * Creating the partitions only needs the disks and partitions, plus the
+ * components and volumes if we have to tell MD about them.  The userspace
+ * tools want everything.
+ *
+ * Return:  TRUE   Decode VBLKs of this type
+ *          FALSE  Skip them
+ */
+static BOOL ldm_vblk_wanted (u8 type)
+{
+#ifdef CONFIG_LDM_EXPORT_SYMBOLS
+	return TRUE;
+#else
+	switch (type) {
+	case VBLK_DSK3:
+	case VBLK_DSK4:
+	case VBLK_PRT3:
+		return TRUE;
+#ifdef CONFIG_BLK_DEV_MD
+	case VBLK_CMP3:
+	case VBLK_VOL5:
+		return TRUE;
+#endif
+	}
+	return FALSE;
+#endif
+}
 
 /**
- * ldm_ldmdb_add - Adds a raw VBLK entry to the ldmdb database
- * @data:  Raw VBLK to add to the database
- * @len:   Size of the raw VBLK
- * @ldb:   Cache of the database structures
+ * ldm_ldmdb_insert - Add a decoded VBLK to the ldmdb database
+ * @vb:   The VBLK to add
+ * @ldb:  Cache of the database structures
  *
  * The VBLKs are sorted into categories.  Partitions are also sorted by offset.
  *
- * N.B.  This function does not check the validity of the VBLKs.
- *
- * Return:  TRUE   The VBLK was added
- *          FALSE  An error occurred
+ * Return:  none
  */
-static BOOL ldm_ldmdb_add (u8 *data, int len, struct ldmdb *ldb)
+static void ldm_ldmdb_insert (struct vblk *vb, struct ldmdb *ldb)
 {
-	struct vblk *vb;
 	struct list_head *item;
 
-	BUG_ON (!data);
+	BUG_ON (!vb);
 	BUG_ON (!ldb);
 
-	vb = kmalloc (sizeof (*vb), GFP_KERNEL);
-	if (!vb) {
-		ldm_crit ("Out of memory.");
-		return FALSE;
-	}
-
-	if (!ldm_parse_vblk (data, len, vb))
-		return FALSE;			/* Already logged */
-
 	/* Put vblk into the correct list. */
 	switch (vb->type) {
 	case VBLK_DGR3:
@@ -1284,13 +1802,12 @@ static BOOL ldm_ldmdb_add (u8 *data, int len, struct ldmdb *ldb)
 			if ((v->vblk.part.disk_id == vb->vblk.part.disk_id) &&
 			    (v->vblk.part.start > vb->vblk.part.start)) {
 				list_add_tail (&vb->list, &v->list);
-				return TRUE;
+				return;
 			}
 		}
 		list_add_tail (&vb->list, &ldb->v_part);
 		break;
 	}
-	return TRUE;
 }
 
 /**
@@ -1300,12 +1817,15 @@ static BOOL ldm_ldmdb_add (u8 *data, int len, struct ldmdb *ldb)
  * @frags:  Linked list of VBLK fragments
  *
  * Fragmented VBLKs may not be consecutive in the database, so they are placed
- * in a list so they can be pieced together later.
+ * in a list so they can be pieced together.  The header of each fragment is
+ * dropped, so the pieces are joined up as one VBLK of
+ * VBLK_SIZE_HEAD + num * (size - VBLK_SIZE_HEAD) bytes.
  *
- * Return:  TRUE   Success, the VBLK was added to the list
- *          FALSE  Error, a problem occurred
+ * Return:  Pointer, the fragment's group, complete when its map is 0xFF
+ *          NULL,    Error, a problem occurred
  */
-static BOOL ldm_frag_add (const u8 *data, int size, struct list_head *frags)
+static struct frag * ldm_frag_add (const u8 *data, int size,
+				   struct list_head *frags)
 {
 	struct frag *f;
 	struct list_head *item;
@@ -1319,7 +1839,11 @@ static BOOL ldm_frag_add (const u8 *data, int size, struct list_head *frags)
 	num   = BE16 (data + 0x0E);
 	if ((num < 1) || (num > 4)) {
 		ldm_error ("A VBLK claims to have %d parts.", num);
-		return FALSE;
+		return NULL;
+	}
+	if (rec >= num) {
+		ldm_error ("REC value (%d) exceeds NUM value (%d).", rec, num);
+		return NULL;
 	}
 
 	list_for_each (item, frags) {
@@ -1331,7 +1855,7 @@ static BOOL ldm_frag_add (const u8 *data, int size, struct list_head *frags)
 	f = kmalloc (sizeof (*f) + size*num, GFP_KERNEL);
 	if (!f) {
 		ldm_crit ("Out of memory.");
-		return FALSE;
+		return NULL;
 	}
 
 	f->group = group;
@@ -1344,18 +1868,16 @@ found:
 	if (f->map & (1 << rec)) {
 		ldm_error ("Duplicate VBLK, part %d.", rec);
 		f->map &= 0x7F;			/* Mark the group as broken */
-		return FALSE;
+		return NULL;
 	}
 
 	f->map |= (1 << rec);
 
-	if (num > 0) {
-		data += VBLK_SIZE_HEAD;
-		size -= VBLK_SIZE_HEAD;
-	}
-	memcpy (f->data+rec*(size-VBLK_SIZE_HEAD)+VBLK_SIZE_HEAD, data, size);
+	data += VBLK_SIZE_HEAD;
+	size -= VBLK_SIZE_HEAD;
+	memcpy (f->data + VBLK_SIZE_HEAD + rec*size, data, size);
 
-	return TRUE;
+	return f;
 }
 
 /**
@@ -1377,67 +1899,89 @@ static void ldm_frag_free (struct list_head *list)
 }
 
 /**
- * ldm_frag_commit - Validate fragmented VBLKs and add them to the database
- * @frags:  Linked list of VBLK fragments
- * @ldb:    Cache of the database structures
- *
- * Now that all the fragmented VBLKs have been collected, they must be added to
- * the database for later use.
- *
- * Return:  TRUE   All the fragments we added successfully
- *          FALSE  One or more of the fragments we invalid
+ * ldm_walk_one - Decode one VBLK and hand it to a visitor
+ * @data:    Raw VBLK, or a reassembled fragmented one
+ * @len:     Size of the raw VBLK
+ * @wanted:  Types of VBLK to decode, or NULL for all of them
+ * @visit:   Visitor
+ * @arg:     Passed on to @visit
+ * @vb:      Spare vblk to decode into, allocated if it's NULL
+ *
+ * Return:  1  Carry on
+ *          0  @visit asked us to stop
+ *         -1  An error occurred
  */
-static BOOL ldm_frag_commit (struct list_head *frags, struct ldmdb *ldb)
+static int ldm_walk_one (const u8 *data, int len, BOOL (*wanted) (u8 type),
+			 ldm_visit_t visit, void *arg, struct vblk **vb)
 {
-	struct frag *f;
-	struct list_head *item;
-
-	BUG_ON (!frags);
-	BUG_ON (!ldb);
-
-	list_for_each (item, frags) {
-		f = list_entry (item, struct frag, list);
-
-		if (f->map != 0xFF) {
-			ldm_error ("VBLK group %d is incomplete (0x%02x).",
-				f->group, f->map);
-			return FALSE;
+	if (wanted && !wanted (data[0x13]))
+		return 1;
+
+	if (!*vb) {
+		*vb = kmalloc (sizeof (**vb), GFP_KERNEL);
+		if (!*vb) {
+			ldm_crit ("Out of memory.");
+			return -1;
 		}
+	}
 
-		if (!ldm_ldmdb_add (f->data, f->num*ldb->vm.vblk_size, ldb))
-			return FALSE;		/* Already logged */
+	memset (*vb, 0, sizeof (**vb));
+	if (!ldm_parse_vblk (data, len, *vb))
+		return -1;			/* Already logged */
+
+	switch (visit (*vb, arg)) {
+	case LDM_VISIT_KEEP:
+		*vb = NULL;			/* It's not ours any more */
+		return 1;
+	case LDM_VISIT_STOP:
+		return 0;
 	}
-	return TRUE;
+	return 1;
 }
 
 /**
- * ldm_get_vblks - Read the on-disk database of VBLKs into memory
- * @bdev:  Device holding the LDM Database
- * @base:  Offset, into @bdev, of the database
- * @ldb:   Cache of the database structures
- *
- * To use the information from the VBLKs, they need to be read from the disk,
- * unpacked and validated.  We cache them in @ldb according to their type.
- *
- * Return:  TRUE   All the VBLKs were read successfully
+ * ldm_walk_vblks - Read the VBLKs, handing each one to a visitor
+ * @bdev:    Device holding the LDM Database
+ * @base:    Offset, into @bdev, of the database
+ * @vm:      VMDB of the database
+ * @wanted:  Types of VBLK to decode, or NULL for all of them
+ * @visit:   Called with each decoded VBLK
+ * @arg:     Passed on to @visit
+ *
+ * Each VBLK is decoded as soon as it has been read.  A fragmented VBLK is
+ * decoded as soon as its last fragment has been read.  Only one sector, the
+ * incomplete fragments and one vblk are held in memory, unless @visit keeps
+ * the VBLKs.  @visit returns one of:
+ *
+ *	LDM_VISIT_DROP  The vblk can be reused
+ *	LDM_VISIT_KEEP  The vblk belongs to @visit now, which must kfree it
+ *	LDM_VISIT_STOP  Stop reading the database
+ *
+ * Return:  TRUE   All the VBLKs were read, or @visit asked us to stop
  *          FALSE  An error occurred
  */
-static BOOL ldm_get_vblks (struct block_device *bdev, unsigned long base,
-			   struct ldmdb *ldb)
+static BOOL ldm_walk_vblks (struct block_device *bdev, unsigned long base,
+			    const struct vmdb *vm, BOOL (*wanted) (u8 type),
+			    ldm_visit_t visit, void *arg)
 {
-	int size, perbuf, skip, finish, s, v, recs;
+	int size, perbuf, skip, finish, s, v, recs, len;
 	u8 *data = NULL;
+	u8 *raw;
 	Sector sect;
 	BOOL result = FALSE;
+	struct vblk *vb = NULL;
+	struct frag *f;
+	int r;
 	LIST_HEAD (frags);
 
 	BUG_ON (!bdev);
-	BUG_ON (!ldb);
+	BUG_ON (!vm);
+	BUG_ON (!visit);
 
-	size   = ldb->vm.vblk_size;
+	size   = vm->vblk_size;
 	perbuf = 512 / size;
-	skip   = ldb->vm.vblk_offset >> 9;		/* Bytes to sectors */
-	finish = (size * ldb->vm.last_vblk_seq) >> 9;
+	skip   = vm->vblk_offset >> 9;			/* Bytes to sectors */
+	finish = (size * vm->last_vblk_seq) >> 9;
 
 	for (s = skip; s < finish; s++) {		/* For each sector */
 		data = read_dev_sector (bdev, base + OFF_VMDB + s, &sect);
@@ -1446,35 +1990,100 @@ static BOOL ldm_get_vblks (struct block_device *bdev, unsigned long base,
 			goto out;
 		}
 
-		for (v = 0; v < perbuf; v++, data+=size) {  /* For each vblk */
-			if (MAGIC_VBLK != BE32 (data)) {
+		for (v = 0; v < perbuf; v++) {		/* For each vblk */
+			raw = data + v * size;
+			if (MAGIC_VBLK != BE32 (raw)) {
 				ldm_error ("Expected to find a VBLK.");
 				goto out;
 			}
 
-			recs = BE16 (data + 0x0E);	/* Number of records */
-			if (recs == 1) {
-				if (!ldm_ldmdb_add (data, size, ldb))
-					goto out;	/* Already logged */
-			} else if (recs > 1) {
-				if (!ldm_frag_add (data, size, &frags))
+			recs = BE16 (raw + 0x0E);	/* Number of records */
+			if (recs == 0)
+				continue;		/* Record is not in use */
+
+			f = NULL;
+			len = size;
+			if (recs > 1) {
+				f = ldm_frag_add (raw, size, &frags);
+				if (!f)
 					goto out;	/* Already logged */
+				if (f->map != 0xFF)
+					continue;	/* Still incomplete */
+				raw = f->data;
+				len = VBLK_SIZE_HEAD + f->num * (size - VBLK_SIZE_HEAD);
+			}
+
+			r = ldm_walk_one (raw, len, wanted, visit, arg, &vb);
+			if (f) {
+				list_del (&f->list);
+				kfree (f);
+			}
+			if (r < 0)
+				goto out;	/* Already logged */
+			if (r == 0) {
+				result = TRUE;
+				goto out;
 			}
-			/* else Record is not in use, ignore it. */
 		}
 		put_dev_sector (sect);
 		data = NULL;
 	}
 
-	result = ldm_frag_commit (&frags, ldb);	/* Failures, already logged */
+	if (!list_empty (&frags)) {
+		f = list_entry (frags.next, struct frag, list);
+		ldm_error ("VBLK group %d is incomplete (0x%02x).",
+			f->group, f->map);
+		goto out;
+	}
+
+	result = TRUE;
 out:
 	if (data)
 		put_dev_sector (sect);
 	ldm_frag_free (&frags);
+	kfree (vb);
 
 	return result;
 }
 
+/**
+ * ldm_ldmdb_visit - Visitor that collects the VBLKs into an ldmdb
+ */
+static int ldm_ldmdb_visit (struct vblk *vb, void *arg)
+{
+	ldm_ldmdb_insert (vb, arg);
+	return LDM_VISIT_KEEP;
+}
+
+/**
+ * ldm_get_vblks - Read the on-disk database of VBLKs into memory
+ * @bdev:  Device holding the LDM Database
+ * @base:  Offset, into @bdev, of the database
+ * @ldb:   Cache of the database structures
+ *
+ * To use the information from the VBLKs, they need to be read from the disk,
+ * unpacked and validated.  We cache them in @ldb according to their type.
+ *
+ * In userspace, ldm_get_vblks_hook can replace this with a reader that must
+ * produce exactly the same lists, e.g. one that decodes in parallel.
+ *
+ * Return:  TRUE   All the VBLKs were read successfully
+ *          FALSE  An error occurred
+ */
+static BOOL ldm_get_vblks (struct block_device *bdev, unsigned long base,
+			   struct ldmdb *ldb)
+{
+	BUG_ON (!bdev);
+	BUG_ON (!ldb);
+
+#ifdef CONFIG_LDM_EXPORT_SYMBOLS
+	if (ldm_get_vblks_hook)
+		return ldm_get_vblks_hook (bdev, base, ldb) ? TRUE : FALSE;
+#endif
+	return ldm_walk_vblks (bdev, base, &ldb->vm, ldm_vblk_wanted,
+			       ldm_ldmdb_visit, ldb);
+}
+
 /**
  * ldm_free_vblks - Free a linked list of vblk's
  * @lh:  Head of a linked list of struct vblk
@@ -1494,6 +2103,174 @@ static void ldm_free_vblks (struct list_head *lh)
 }
 
 
+/*
+ * Every member of a disk group holds a copy of the same database.  When the
+ * members are probed one after another, only the first has its VBLKs read;
+ * the rest share its lists.  A group is identified by the GUID and committed
+ * sequence number in its VMDB, so a database that has changed is read again.
+ *
+ * In userspace the databases belong to the callers of ldm_partition.  In the
+ * kernel they belong to the list, which also survives rescans.  It's kept in
+ * most-recently-used order and holds at most CONFIG_LDM_CACHE groups.
+ */
+static LIST_HEAD (ldm_groups);
+
+#ifdef CONFIG_LDM_EXPORT_SYMBOLS
+#define ldm_group_lock()	do {} while (0)
+#define ldm_group_unlock()	do {} while (0)
+#else
+static DECLARE_MUTEX (ldm_group_sem);
+static int ldm_group_count;
+#define ldm_group_lock()	down (&ldm_group_sem)
+#define ldm_group_unlock()	up (&ldm_group_sem)
+
+/**
+ * ldm_ldmdb_free - Free a database and all its VBLKs
+ * @ldb:  Cache of the database structures
+ *
+ * Return:  none
+ */
+static void ldm_ldmdb_free (struct ldmdb *ldb)
+{
+	BUG_ON (!ldb);
+
+	ldm_free_vblks (&ldb->v_dgrp);
+	ldm_free_vblks (&ldb->v_disk);
+	ldm_free_vblks (&ldb->v_volu);
+	ldm_free_vblks (&ldb->v_comp);
+	ldm_free_vblks (&ldb->v_part);
+	kfree (ldb);
+}
+#endif
+
+/**
+ * ldm_group_find - Find a disk group parsed by an earlier probe
+ * @vm:  VMDB of the disk being probed
+ *
+ * The caller must hold the group lock for as long as it uses the result.
+ *
+ * Return:  Pointer, the database of the group
+ *          NULL,    Unknown group, or its database has changed since
+ */
+static struct ldmdb * ldm_group_find (const struct vmdb *vm)
+{
+	struct list_head *item;
+
+	BUG_ON (!vm);
+
+	list_for_each (item, &ldm_groups) {
+		struct ldm_group *g = list_entry (item, struct ldm_group, list);
+		if (!strcmp (g->dg_id, vm->dg_id) && (g->seq == vm->committed_seq)) {
+			list_del (&g->list);		/* Most recently used */
+			list_add (&g->list, &ldm_groups);
+			return g->ldb;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * ldm_group_add - Remember the database of a disk group
+ * @ldb:  Cache of the database structures, with its VBLKs read
+ *
+ * An older database of the same group is replaced.  In the kernel, the least
+ * recently used group is dropped if the list is full.  If we run out of memory
+ * the group simply isn't remembered.
+ *
+ * The caller must hold the group lock.
+ *
+ * Return:  TRUE   @ldb belongs to the list now (kernel only)
+ *          FALSE  @ldb wasn't remembered
+ */
+static BOOL ldm_group_add (struct ldmdb *ldb)
+{
+	struct list_head *item;
+	struct ldm_group *g;
+
+	BUG_ON (!ldb);
+
+	list_for_each (item, &ldm_groups) {
+		g = list_entry (item, struct ldm_group, list);
+		if (!strcmp (g->dg_id, ldb->vm.dg_id)) {
+#ifndef CONFIG_LDM_EXPORT_SYMBOLS
+			ldm_ldmdb_free (g->ldb);
+#endif
+			g->seq = ldb->vm.committed_seq;
+			g->ldb = ldb;
+			list_del (&g->list);
+			list_add (&g->list, &ldm_groups);
+			return TRUE;
+		}
+	}
+
+#ifndef CONFIG_LDM_EXPORT_SYMBOLS
+	if (CONFIG_LDM_CACHE < 1)
+		return FALSE;
+
+	if (ldm_group_count >= CONFIG_LDM_CACHE) {
+		g = list_entry (ldm_groups.prev, struct ldm_group, list);
+		ldm_debug ("Dropping the database of disk group %s.", g->dg_id);
+		list_del (&g->list);
+		ldm_ldmdb_free (g->ldb);
+		kfree (g);
+		ldm_group_count--;
+	}
+#endif
+
+	g = kmalloc (sizeof (*g), GFP_KERNEL);
+	if (!g)
+		return FALSE;
+
+	memcpy (g->dg_id, ldb->vm.dg_id, sizeof (g->dg_id));
+	g->seq = ldb->vm.committed_seq;
+	g->ldb = ldb;
+	list_add (&g->list, &ldm_groups);
+#ifndef CONFIG_LDM_EXPORT_SYMBOLS
+	ldm_group_count++;
+#endif
+	return TRUE;
+}
+
+#ifdef CONFIG_LDM_EXPORT_SYMBOLS
+/**
+ * ldm_group_db - Find the VBLKs describing a probed disk
+ * @ldb:  Cache of the database structures, as passed to ldm_partition
+ *
+ * If the database was shared with an earlier member of the disk group, the
+ * VBLK lists of @ldb are empty and those of the earlier disk are returned.
+ *
+ * Return:  Pointer, the database holding the VBLKs
+ */
+struct ldmdb * ldm_group_db (const struct ldmdb *ldb)
+{
+	struct ldmdb *db;
+
+	BUG_ON (!ldb);
+
+	db = ldm_group_find (&ldb->vm);
+	return db ? db : (struct ldmdb *) ldb;
+}
+
+/**
+ * ldm_group_free - Forget every disk group
+ *
+ * The databases themselves still belong to the callers of ldm_partition and
+ * must be freed by them, after this.
+ *
+ * Return:  none
+ */
+void ldm_group_free (void)
+{
+	struct list_head *item, *tmp;
+
+	list_for_each_safe (item, tmp, &ldm_groups)
+		kfree (list_entry (item, struct ldm_group, list));
+
+	INIT_LIST_HEAD (&ldm_groups);
+}
+#endif
+
 /**
  * ldm_partition - Find out whether a device is a dynamic disk and handle it
  * @pp:    List of the partitions parsed so far
@@ -1507,6 +2284,10 @@ static void ldm_free_vblks (struct list_head *lh)
  * example, if the device is hda, we would have: hda1: LDM database, hda2, hda3,
  * and so on: the actual data containing partitions.
  *
+ * The database of a disk group is only read from the first of its members to
+ * be probed.  The other members, and later rescans, validate their own PRIVHEAD
+ * and VMDB and then share it.
+ *
  * Return:  1 Success, @bdev is a dynamic disk and we handled it
  *          0 Success, @bdev is not a dynamic disk
  *         -1 An error occurred before enough information had been read
@@ -1521,38 +2302,34 @@ int ldm_partition (struct parsed_partitions *pp, struct block_device *bdev)
 #ifndef CONFIG_LDM_EXPORT_SYMBOLS
 	struct ldmdb  *ldb;
 #endif
+	struct ldmdb  *db;
+	struct privhead *ph;
+	struct ldm_label label;
 	unsigned long base;
 	int result = -1;
 
 	BUG_ON (!pp);
 	BUG_ON (!bdev);
 
+	if (!ldm_probe_wanted (pp->name)) {
+		ldm_debug ("Not probing %s.", pp->name);
+		return 0;
+	}
+
+	ldm_readahead (bdev, 0, ldm_probe_head, 2);
+
 	/* Look for signs of a Dynamic Disk */
-	if (!ldm_validate_partition_table (bdev))
+	if (!ldm_validate_partition_table (bdev, pp->name, &label))
 		return 0;
 
 #ifndef CONFIG_LDM_EXPORT_SYMBOLS
 	ldb = kmalloc (sizeof (*ldb), GFP_KERNEL);
 	if (!ldb) {
 		ldm_crit ("Out of memory.");
-		goto out;
+		return -1;
 	}
-#endif
-
-	/* Parse and check privheads. */
-	if (!ldm_validate_privheads (bdev, &ldb->ph))
-		goto out;		/* Already logged */
-
-	/* All further references are relative to base (database start). */
-	base = ldb->ph.config_start;
-
-	/* Parse and check tocs and vmdb. */
-	if (!ldm_validate_tocblocks (bdev, base, ldb) ||
-	    !ldm_validate_vmdb      (bdev, base, ldb))
-	    	goto out;		/* Already logged */
 
 	/* Initialize vblk lists in ldmdb struct */
-#ifndef CONFIG_LDM_EXPORT_SYMBOLS
 	INIT_LIST_HEAD (&ldb->v_dgrp);
 	INIT_LIST_HEAD (&ldb->v_disk);
 	INIT_LIST_HEAD (&ldb->v_volu);
@@ -1560,34 +2337,113 @@ int ldm_partition (struct parsed_partitions *pp, struct block_device *bdev)
 	INIT_LIST_HEAD (&ldb->v_part);
 #endif
 
+	/* Parse and check privheads. */
+	ph = &ldb->ph;
+	if (!ldm_validate_privheads (bdev, &label, ph))
+		goto out;		/* Already logged */
+
+	/* All further references are relative to base (database start). */
+	base = ph->config_start;
+
+	/* Parse and check vmdb and tocs. */
+	if (!ldm_validate_vmdb (bdev, base, ldb))
+		goto out;		/* Already logged */
+
+	/* Has another member of this disk group been parsed already? */
+	ldm_group_lock();
+	db = ldm_group_find (&ldb->vm);
+	if (db) {
+		ldm_debug ("Sharing the database of disk group %s.", ldb->vm.dg_id);
+		memcpy (&ldb->toc, &db->toc, sizeof (ldb->toc));
+		goto create;
+	}
+	ldm_group_unlock();
+
+	if (!ldm_validate_tocblocks (bdev, base, ldb))
+		goto out;		/* Already logged */
+
 	if (!ldm_get_vblks (bdev, base, ldb)) {
 		ldm_crit ("Failed to read the VBLKs from the database.");
-		goto cleanup;
+		goto out;
 	}
 
+	ldm_group_lock();
+	db = ldb;
+#ifndef CONFIG_LDM_EXPORT_SYMBOLS
+	if (ldm_group_add (ldb))
+		ldb = NULL;		/* The list owns it now */
+#else
+	ldm_group_add (ldb);
+#endif
+create:
 	/* Finally, create the data partition devices. */
 #ifdef CONFIG_BLK_DEV_MD
-	if (ldm_create_data_partitions (pp, ldb, bdev)) {
+	if (ldm_create_data_partitions (pp, ph, db, bdev)) {
 #else
-	if (ldm_create_data_partitions (pp, ldb)) {
+	if (ldm_create_data_partitions (pp, ph, db)) {
 #endif
 		ldm_debug ("Parsed LDM database successfully.");
 		result = 1;
 	}
 	/* else Already logged */
+	ldm_group_unlock();
 
-cleanup:
-#ifndef CONFIG_LDM_EXPORT_SYMBOLS
-	ldm_free_vblks (&ldb->v_dgrp);
-	ldm_free_vblks (&ldb->v_disk);
-	ldm_free_vblks (&ldb->v_volu);
-	ldm_free_vblks (&ldb->v_comp);
-	ldm_free_vblks (&ldb->v_part);
-#endif
 out:
 #ifndef CONFIG_LDM_EXPORT_SYMBOLS
-	kfree (ldb);
+	if (ldb)
+		ldm_ldmdb_free (ldb);
 #endif
 	return result;
 }
 
+#ifdef CONFIG_LDM_EXPORT_SYMBOLS
+/**
+ * ldm_stream - Hand each VBLK of a dynamic disk's database to a visitor
+ * @bdev:   Device holding the LDM Database
+ * @visit:  Called with each VBLK, see ldm_walk_vblks
+ * @arg:    Passed on to @visit
+ *
+ * The headers are validated just as they are for ldm_partition, but the VBLKs
+ * are never collected, so the memory used doesn't depend on the size of the
+ * database.
+ *
+ * Return:  1 Success, every VBLK was visited, or @visit asked us to stop
+ *          0 Success, @bdev is not a dynamic disk
+ *         -1 An error occurred
+ */
+int ldm_stream (struct block_device *bdev, ldm_visit_t visit, void *arg)
+{
+	struct ldm_label label;
+	struct ldmdb *ldb;
+	unsigned long base;
+	int result = -1;
+
+	BUG_ON (!bdev);
+	BUG_ON (!visit);
+
+	ldm_readahead (bdev, 0, ldm_probe_head, 2);
+
+	if (!ldm_validate_partition_table (bdev, NULL, &label))
+		return 0;
+
+	ldb = kmalloc (sizeof (*ldb), GFP_KERNEL);
+	if (!ldb) {
+		ldm_crit ("Out of memory.");
+		return -1;
+	}
+
+	if (!ldm_validate_privheads (bdev, &label, &ldb->ph))
+		goto out;		/* Already logged */
+
+	base = ldb->ph.config_start;
+	if (!ldm_validate_vmdb      (bdev, base, ldb) ||
+	    !ldm_validate_tocblocks (bdev, base, ldb))
+		goto out;		/* Already logged */
+
+	if (ldm_walk_vblks (bdev, base, &ldb->vm, NULL, visit, arg))
+		result = 1;
+out:
+	kfree (ldb);
+	return result;
+}
+#endif
@@ -93,7 +93,20 @@ struct parsed_partitions;
 
 #define OFF_VMDB		17		/* List of partitions. */
 
+#define TOC_QUORUM		2		/* TOCBLOCKs that must arrive */
+
+#define COPY_OK			0		/* State of a redundant copy */
+#define COPY_FAILED		1		/* The read failed */
+#define COPY_LATE		2		/* Given up on, too slow */
+
 #define WIN2K_DYNAMIC_PARTITION	0x42		/* Formerly SFS (Landis). */
+#define GPT_PROTECTIVE_PARTITION 0xEE		/* The disk has a GPT. */
+
+#define OFF_GPT			1		/* GPT header, in sectors */
+#define GPT_SIGNATURE		"EFI PART"
+#define GPT_HEADER_MIN		92		/* Size of a GPT header, */
+#define GPT_ENTRIES_MAX		128		/* and most sectors of entries */
+#define GPT_ENTRY_MIN		128		/* Size of a GPT entry */
 
 #define TOC_BITMAP1		"config"	/* Names of the two defined */
 #define TOC_BITMAP2		"log"		/* bitmaps in the TOCBLOCK. */
@@ -103,6 +116,10 @@ struct parsed_partitions;
 #define BE32(x)			((u32)be32_to_cpu(get_unaligned((u32*)(x))))
 #define BE64(x)			((u64)be64_to_cpu(get_unaligned((u64*)(x))))
 
+/* Except in a GPT, where they're little-endian. */
+#define LE32(x)			((u32)le32_to_cpu(get_unaligned((u32*)(x))))
+#define LE64(x)			((u64)le64_to_cpu(get_unaligned((u64*)(x))))
+
 /* Borrowed from msdos.c */
 #define SYS_IND(p)		(get_unaligned(&(p)->sys_ind))
 
@@ -119,6 +136,15 @@ struct frag {				/* VBLK Fragment handling */
 
 #define GUID_SIZE		16
 
+struct ldm_label {			/* Where the LDM is, from the MBR or GPT */
+	unsigned long	ph1;		/* Sector of the primary PRIVHEAD */
+	int	gpt;
+	u64	meta_start;		/* GPT: the LDM metadata partition */
+	u64	meta_size;
+	u64	data_start;		/* GPT: the LDM data partition, */
+	u64	data_size;		/*      or 0 if there isn't one */
+};
+
 struct privhead {			/* Offsets and sizes are in sectors. */
 	u16	ver_major;
 	u16	ver_minor;
@@ -144,6 +170,8 @@ struct vmdb {				/* VMDB: The database header */
 	u32	vblk_size;
 	u32	vblk_offset;
 	u32	last_vblk_seq;
+	u64	committed_seq;		/* Bumped by every transaction */
+	u8	dg_id[64];		/* Disk group GUID, as text */
 };
 
 struct vblk_comp {			/* VBLK Component */
@@ -214,8 +242,38 @@ struct ldmdb {				/* Cache of the database */
 	struct list_head v_part;
 };
 
+enum {					/* Replies from a VBLK visitor */
+	LDM_VISIT_DROP = 0,		/* Finished with the VBLK */
+	LDM_VISIT_KEEP,			/* Keeping the VBLK, will kfree it */
+	LDM_VISIT_STOP			/* Don't read any more VBLKs */
+};
+
+typedef int (*ldm_visit_t) (struct vblk *vb, void *arg);
+
+struct ldm_group {			/* A disk group seen by an earlier probe */
+	struct list_head list;
+	u8	dg_id[64];
+	u64	seq;			/* VMDB committed sequence number */
+	struct ldmdb *ldb;		/* The disk whose VBLKs we kept */
+};
+
+#ifndef CONFIG_LDM_CACHE
+#define CONFIG_LDM_CACHE	4	/* Disk groups kept by the kernel */
+#endif
+
 #ifdef CONFIG_LDM_EXPORT_SYMBOLS
+int ldm_stream (struct block_device *bdev, ldm_visit_t visit, void *arg);
+extern int (*ldm_get_vblks_hook) (struct block_device *bdev, unsigned long base,
+				  struct ldmdb *ldb);
+extern void (*ldm_readahead_hook) (struct block_device *bdev, unsigned long base,
+				   const int *off, int count);
+extern char *ldm_probe_list;
+extern void (*ldm_read_copies_hook) (struct block_device *bdev, unsigned long base,
+				     const int *off, int count, u8 *buf, int *state);
+
 int ldm_partition (struct parsed_partitions *pp, struct block_device *bdev, struct ldmdb *ldb);
+struct ldmdb * ldm_group_db (const struct ldmdb *ldb);
+void ldm_group_free (void);
 #else
 int ldm_partition (struct parsed_partitions *pp, struct block_device *bdev);
 #endif
@@ -21,11 +21,13 @@
  * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <asm/unistd.h>
+
 #include "ldminfo.h"
 #include "check.h"
 
-int device = 0;
 int debug  = 0;
+__thread int printk_quiet = 0;	/* Set in decoding threads */
 
 /* external dependencies */
 void *	malloc	(size_t size);
@@ -44,9 +46,191 @@ int ldm_mem_maxa  = 0;	/* Max memory allocated */
 int ldm_mem_count = 0;	/* Number of memory blocks */
 int ldm_mem_maxc  = 0;	/* Max memory blocks */
 
+/**
+ * clock_us - The time in microseconds
+ */
+static long long clock_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);	/* Never steps back */
+	return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * A budget for probing one device.  Once a limit has been reached, reads
+ * fail, as do allocations over the memory limit, so the LDM code gives up
+ * the way it would on a bad disk and frees what it has.  ldm_budget_spent
+ * says which limit it was.
+ *
+ * Time is only checked between reads; a read that hangs isn't interrupted.
+ * Sectors found in the cache don't count as reads.
+ */
+int ldm_budget_secs  = 0;	/* Limits for each device, 0 for none */
+int ldm_budget_reads = 0;
+int ldm_budget_mem   = 0;
+const char *ldm_budget_spent = NULL;
+
+static int       budget_on    = 0;
+static long long budget_start = 0;	/* In microseconds */
+static int       budget_reads = 0;
+static int       budget_base  = 0;	/* ldm_mem_size at the start */
+
+/**
+ * budget_begin - Start spending the budget for a device
+ */
+void budget_begin (void)
+{
+	budget_on    = 1;
+	budget_start = clock_us();
+	budget_reads = 0;
+	budget_base  = ldm_mem_size;
+	ldm_budget_spent = NULL;
+}
+
+/**
+ * budget_end - Stop spending, when the probe of a device is over
+ */
+void budget_end (void)
+{
+	budget_on = 0;
+}
+
+/**
+ * budget_read - Account for a read from the device
+ *
+ * Return:  1  The read can go ahead
+ *          0  The budget has been spent
+ */
+int budget_read (void)
+{
+	if (!budget_on)
+		return 1;
+	if (ldm_budget_spent)
+		return 0;
+
+	if (ldm_budget_secs &&
+	    ((clock_us() - budget_start) >= ldm_budget_secs * 1000000LL))
+		ldm_budget_spent = "out of time";
+	else if (ldm_budget_reads &&
+		 (__sync_add_and_fetch (&budget_reads, 1) > ldm_budget_reads))
+		ldm_budget_spent = "too many reads";
+
+	return !ldm_budget_spent;
+}
+
+/*
+ * Limits on the rate of reads, so that a sweep doesn't get in the way of the
+ * disks' real work.  These are the token buckets of ldmutil/iolimit.cpp.
+ */
+int ldm_limit_iops = 0;		/* Reads per second, 0 for no limit */
+int ldm_limit_bw   = 0;		/* Bytes per second */
+
+struct bucket {
+	long long	level;		/* Millionths of a token */
+	long long	when;		/* Time of the last refill, in us */
+};
+
+static struct bucket bucket_ops;
+static struct bucket bucket_bytes;
+static int throttle_lock = 0;	/* The hedged reads come from threads */
+
+/**
+ * bucket_refill - Top up a bucket
+ *
+ * Return:  The microseconds until the bucket is out of debt
+ */
+static long long bucket_refill (struct bucket *b, long long rate, long long now)
+{
+	long long full = rate * 100000;		/* 0.1 s worth */
+
+	if (!rate)
+		return 0;
+
+	if (b->when)
+		b->level += rate * (now - b->when);
+	else
+		b->level = full;
+	if (b->level > full)
+		b->level = full;
+	b->when = now;
+
+	return (b->level >= 0) ? 0 : (-b->level / rate + 1);
+}
+
+/**
+ * throttle_read - Wait until a read of @len bytes is allowed
+ */
+void throttle_read (int len)
+{
+	long long now, wait, w;
+
+	if (!ldm_limit_iops && !ldm_limit_bw)
+		return;
+
+	for (;;) {
+		while (__sync_lock_test_and_set (&throttle_lock, 1))
+			;
+		now  = clock_us();
+		wait = bucket_refill (&bucket_ops,   ldm_limit_iops, now);
+		w    = bucket_refill (&bucket_bytes, ldm_limit_bw,   now);
+		if (w > wait)
+			wait = w;
+		if (!wait) {
+			bucket_ops.level   -= 1000000;
+			bucket_bytes.level -= (long long) len * 1000000;
+		}
+		__sync_lock_release (&throttle_lock);
+
+		if (!wait)
+			return;
+		usleep (wait);
+	}
+}
+
+/* From linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_BE		2
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+
+/**
+ * set_io_class - Set the I/O priority class: "idle" or "best-effort"
+ *
+ * Best effort is at the lowest level.  Threads started later inherit it.
+ *
+ * Return:  0  Success
+ *         -1  Unknown class, or the kernel doesn't support it
+ */
+int set_io_class (const char *name)
+{
+	int prio;
+
+	if (strcmp (name, "idle") == 0)
+		prio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+	else if (strcmp (name, "best-effort") == 0)
+		prio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7;
+	else
+		return -1;
+
+#ifdef __NR_ioprio_set
+	return syscall (__NR_ioprio_set, IOPRIO_WHO_PROCESS, 0, prio);
+#else
+	return -1;
+#endif
+}
+
 void * __kmalloc (size_t size, int flags, char *fn)
 {
-	void *ptr = malloc (size + sizeof (int));
+	void *ptr;
+
+	if (budget_on && ldm_budget_mem &&
+	    ((ldm_mem_size - budget_base + (int) size) > ldm_budget_mem)) {
+		ldm_budget_spent = "out of memory";
+		return NULL;
+	}
+
+	ptr = malloc (size + sizeof (int));
 	//printf ("malloc %p %6zu in %s\n", ptr, size, fn);
 	ldm_mem_alloc++;
 	ldm_mem_size += size;
@@ -74,6 +258,9 @@ int printk (const char *fmt, ...)
 	char buf[1024];
 	va_list args;
 
+	if (printk_quiet)
+		return 0;
+
 	va_start (args, fmt);
 	vsnprintf (buf, sizeof (buf), fmt, args);
 	va_end (args);
@@ -127,13 +314,12 @@ struct buffer_head * ldm_bread (kdev_t dev, int block, int size)
 
 		bh->b_data = kmalloc (size, 0);
 
-		if (lseek64 (device, offset, SEEK_SET) < 0)
-			printk (LDM_CRIT "lseek to %lld failed\n", offset);
-		else if (read (device, bh->b_data, size) < size)
-			printk (LDM_CRIT "read failed\n");
+		if (dev_read (bh->b_data, offset, size) < size)
+			printk (LDM_CRIT "read at %lld failed\n", offset);
 		else
 			goto bread_end;
 
+		kfree (bh->b_data);
 		kfree (bh);
 		bh = NULL;
 	}
@@ -141,14 +327,179 @@ bread_end:
 	return bh;
 }
 
+/*
+ * A small cache of sectors in front of read_dev_sector.  The LDM code reads
+ * the same few sectors more than once, and reads the VBLKs one sector at a
+ * time, so a miss reads ahead: the missing sector and those after it that
+ * aren't cached yet are read in one go.  The entries live in a static table
+ * and are reused, so a read from the cache never allocates.
+ *
+ * Each entry is a page with a reference count, as in the kernel.  The cache
+ * only replaces entries that nobody is using.
+ */
+#define CACHE_SECTORS	64		/* Sectors held in the cache */
+#define CACHE_RUN	16		/* Most sectors read at once */
+
+struct cache_entry {
+	struct page		pg;
+	struct buffer_head	bh;
+	unsigned long		sector;
+	unsigned long		used;		/* When last read, for LRU */
+	int			valid;
+	u8			data[512];
+};
+
+static struct cache_entry cache[CACHE_SECTORS];
+static unsigned long cache_clock;
+
+int ldm_cache_hits   = 0;	/* Sectors found in the cache */
+int ldm_cache_misses = 0;	/* Sectors that weren't */
+int ldm_cache_reads  = 0;	/* Reads from the device */
+
+/**
+ * cache_find - Find a sector in the cache
+ */
+static struct cache_entry * cache_find (unsigned long n)
+{
+	int i;
+
+	for (i = 0; i < CACHE_SECTORS; i++)
+		if (cache[i].valid && (cache[i].sector == n))
+			return cache + i;
+
+	return NULL;
+}
+
+/**
+ * cache_victim - Find an entry to reuse: empty, or the oldest unused one
+ */
+static struct cache_entry * cache_victim (void)
+{
+	struct cache_entry *ce = NULL;
+	int i;
+
+	for (i = 0; i < CACHE_SECTORS; i++) {
+		if (atomic_read (&cache[i].pg.count) > 0)
+			continue;
+		if (!cache[i].valid)
+			return cache + i;
+		if (!ce || (cache[i].used < ce->used))
+			ce = cache + i;
+	}
+
+	return ce;
+}
+
+/**
+ * cache_fill - Read a run of sectors into the cache
+ * @n:      First sector, which isn't in the cache
+ * @entry:  Returns the entry for sector @n
+ *
+ * Return:  1  Success
+ *          0  Every entry is in use, nothing was read
+ *         -1  The read failed
+ */
+static int cache_fill (unsigned long n, struct cache_entry **entry)
+{
+	u8 buf[CACHE_RUN * 512];
+	struct cache_entry *ce;
+	unsigned long start = cache_clock;
+	int count;
+	int got;
+	int i;
+
+	*entry = NULL;
+	if (!cache_victim())
+		return 0;
+
+	for (count = 1; count < CACHE_RUN; count++)
+		if (cache_find (n + count))
+			break;
+
+	got = dev_read (buf, ((long long) n) << 9, count << 9);
+	ldm_cache_reads++;
+	if (got < 512)
+		return -1;
+
+	for (i = 0; i < (got >> 9); i++) {
+		ce = cache_victim();
+		if (!ce)
+			break;
+		if (ce->valid && (ce->used > start))
+			break;		/* Filled by us, maybe with sector @n */
+		ce->valid  = 1;
+		ce->sector = n + i;
+		ce->used   = ++cache_clock;
+		memcpy (ce->data, buf + (i << 9), 512);
+		if (!*entry)
+			*entry = ce;
+	}
+
+	return 1;
+}
+
+/**
+ * sector_cache_prefetch - Read some sectors into the cache ahead of time
+ *
+ * This is ldm_readahead_hook.  Neighbouring sectors share one read.
+ */
+void sector_cache_prefetch (struct block_device *bdev, unsigned long base,
+			    const int *off, int count)
+{
+	struct cache_entry *ce;
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (!cache_find (base + off[i]))
+			cache_fill (base + off[i], &ce);
+}
+
+/**
+ * sector_cache_flush - Forget everything, when the device changes
+ */
+void sector_cache_flush (void)
+{
+	int i;
+
+	for (i = 0; i < CACHE_SECTORS; i++)
+		cache[i].valid = 0;
+}
+
+/**
+ * read_dev_sector - Read a sector, through the cache if possible
+ */
 unsigned char *read_dev_sector (struct block_device *bdev, unsigned long n, Sector *sect)
 {
+	struct cache_entry *ce;
 	struct page        *pg = NULL;
 	struct buffer_head *bh = NULL;
 
 	if (!bdev || !sect)
 		return NULL;
 
+	ce = cache_find (n);
+	if (ce) {
+		ldm_cache_hits++;
+		ce->used = ++cache_clock;
+	} else {
+		ldm_cache_misses++;
+		if (cache_fill (n, &ce) < 0)
+			return NULL;	/* Don't spend another read on it */
+	}
+
+	if (ce) {
+		atomic_inc (&ce->pg.count);
+		ce->bh.b_data = ce->data;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,5,8)
+		ce->pg.buffers = &ce->bh;
+#else
+		ce->pg.private = (unsigned long) &ce->bh;
+#endif
+		sect->v = &ce->pg;
+		return ce->data;
+	}
+
+	/* Every entry is in use, so do it the slow way */
 	pg = (struct page *) kmalloc (sizeof (*pg), 0);
 	if (!pg)
 		return NULL;
@@ -173,6 +524,12 @@ unsigned char *read_dev_sector (struct block_device *bdev, unsigned long n, Sect
 
 void __free_pages(struct page *page, unsigned int order)
 {
+	if (((void *) page >= (void *) cache) &&
+	    ((void *) page <  (void *) (cache + CACHE_SECTORS))) {
+		atomic_dec (&page->count);	/* The cache keeps it */
+		return;
+	}
+
 	atomic_dec (&page->count);
 	if (atomic_read (&page->count) < 1) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,5,8)
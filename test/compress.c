@@ -0,0 +1,212 @@
+/**
+ * ldminfo - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Richard Russon <ldm@flatcap.org>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ldminfo.h"
+
+/*
+ * A small LZ77 codec for compressed captures.  The database is mostly empty,
+ * so long runs matter far more than a good ratio on the VBLKs themselves.
+ *
+ * The compressed stream is a series of tokens, each starting with a control
+ * byte:
+ *
+ *	0nnnnnnn		n+1 literal bytes follow
+ *	1mmmmmmm [ext] off	Copy m+4 bytes from off (2 bytes) back.  If m is
+ *				127, extension bytes are added to the length
+ *				until one is less than 255.
+ */
+
+#define HASH_BITS	12
+
+/**
+ * hash4 - Hash the four bytes at @p
+ */
+static inline u32 hash4 (const u8 *p)
+{
+	u32 v = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+
+	return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/**
+ * put_literals - Write a run of literal bytes
+ */
+static int put_literals (u8 *dst, const u8 *src, int len)
+{
+	int o = 0;
+	int n;
+
+	while (len > 0) {
+		n = (len > 128) ? 128 : len;
+		dst[o++] = n - 1;
+		memcpy (dst + o, src, n);
+		o   += n;
+		src += n;
+		len -= n;
+	}
+
+	return o;
+}
+
+/**
+ * put_match - Write a back-reference
+ */
+static int put_match (u8 *dst, int len, int off)
+{
+	int o = 0;
+
+	len -= 4;
+	if (len < 127) {
+		dst[o++] = 0x80 | len;
+	} else {
+		dst[o++] = 0xFF;
+		for (len -= 127; len >= 255; len -= 255)
+			dst[o++] = 255;
+		dst[o++] = len;
+	}
+
+	dst[o++] = off >> 8;
+	dst[o++] = off;
+	return o;
+}
+
+/**
+ * ldmz_compress - Compress one block
+ * @src:  Data to compress, at most LDMZ_BLOCK bytes
+ * @len:  Length of @src
+ * @dst:  Output buffer, at least LDMZ_BOUND(@len) bytes
+ *
+ * Return:  n  Size of the compressed data, which may exceed @len
+ */
+int ldmz_compress (const u8 *src, int len, u8 *dst)
+{
+	int table[1 << HASH_BITS];
+	int lit = 0;
+	int i = 0;
+	int o = 0;
+	int ref;
+	int m;
+	u32 h;
+
+	memset (table, 0, sizeof (table));
+
+	while (i + 4 <= len) {
+		h = hash4 (src + i);
+		ref = table[h] - 1;
+		table[h] = i + 1;
+
+		if ((ref < 0) || (i - ref > 0xFFFF) || (memcmp (src + ref, src + i, 4) != 0)) {
+			i++;
+			continue;
+		}
+
+		for (m = 4; (i + m < len) && (src[ref + m] == src[i + m]); m++)
+			;
+
+		o  += put_literals (dst + o, src + lit, i - lit);
+		o  += put_match    (dst + o, m, i - ref);
+		i  += m;
+		lit = i;
+	}
+
+	return o + put_literals (dst + o, src + lit, len - lit);
+}
+
+/**
+ * ldmz_decompress - Decompress one block
+ * @src:   Compressed data
+ * @slen:  Length of @src
+ * @dst:   Output buffer
+ * @dlen:  Expected size of the output
+ *
+ * Return:  0  Success
+ *         -1  The data is corrupt
+ */
+int ldmz_decompress (const u8 *src, int slen, u8 *dst, int dlen)
+{
+	int i = 0;
+	int o = 0;
+	int len;
+	int off;
+	u8 c;
+
+	while (i < slen) {
+		c = src[i++];
+		if (c < 0x80) {
+			len = c + 1;
+			if ((i + len > slen) || (o + len > dlen))
+				return -1;
+			memcpy (dst + o, src + i, len);
+			i += len;
+			o += len;
+			continue;
+		}
+
+		len = (c & 0x7F) + 4;
+		if (c == 0xFF) {
+			do {
+				if (i >= slen)
+					return -1;
+				len += src[i];
+			} while (src[i++] == 255);
+		}
+
+		if (i + 2 > slen)
+			return -1;
+		off = (src[i] << 8) | src[i + 1];
+		i += 2;
+
+		if ((off == 0) || (off > o) || (o + len > dlen))
+			return -1;
+
+		for (; len > 0; len--, o++)	/* May overlap */
+			dst[o] = dst[o - off];
+	}
+
+	return (o == dlen) ? 0 : -1;
+}
+
+/**
+ * ldmz_crc32 - Update a CRC-32 (as used by zlib) with some more data
+ */
+u32 ldmz_crc32 (u32 crc, const u8 *buf, int len)
+{
+	static u32 table[256];
+	u32 c;
+	int i;
+	int j;
+
+	if (!table[1]) {
+		for (i = 0; i < 256; i++) {
+			for (c = i, j = 0; j < 8; j++)
+				c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+			table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	while (len-- > 0)
+		crc = table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
@@ -29,9 +29,10 @@
 /**
  * copy_database - Save the LDM Database to a file
  */
-void copy_database (char *file, int device, long long size)
+void copy_database (char *file, long long size)
 {
 	unsigned char *buffer;
+	int got;
 	int fpart = 0;	/* Partition table + primary PRIVHEAD */
 	int fdata = 0;	/* LDM Database */
 
@@ -57,11 +58,7 @@ void copy_database (char *file, int device, long long size)
 	}
 
 	/* First copy the partition table and primary PRIVHEAD to fpart */
-	if (lseek64 (device, 0, SEEK_SET) < 0) {
-		printf ("lseek to %d failed\n", 0);
-		goto out;
-	}
-	if (read (device, buffer, BUFSIZE) < BUFSIZE) {
+	if (dev_read (buffer, 0, BUFSIZE) < BUFSIZE) {
 		printf ("Couldn't read the partition table and primary PRIVHEAD\n");
 		goto out;
 	}
@@ -82,16 +79,12 @@ void copy_database (char *file, int device, long long size)
 
 	size -= 1048576;	/* 1 MiB */
 
-	if (lseek64 (device, size, SEEK_SET) < 0) {
-		printf ("lseek to %lld failed\n", size);
-		goto out;
-	}
-
-	while (read (device, buffer, BUFSIZE) > 0) {
-		if (write (fdata, buffer, BUFSIZE) < 0) {
+	while ((got = dev_read (buffer, size, BUFSIZE)) > 0) {
+		if (write (fdata, buffer, got) < got) {
 			printf ("Couldn't write to data file\n");
 			goto out;
 		}
+		size += got;
 	}
 
 	printf ("Successfully copied the LDM data\n");
@@ -101,3 +94,117 @@ out:
 	close (fdata);
 }
 
+/**
+ * put_be - Store a big-endian number of @len bytes
+ */
+static void put_be (u8 *p, unsigned long long v, int len)
+{
+	while (len-- > 0) {
+		p[len] = v;
+		v >>= 8;
+	}
+}
+
+/**
+ * copy_extent - Compress part of the device into a .ldmz file
+ *
+ * The extent is read, compressed and written one block at a time, so only a
+ * single block is ever held in memory.
+ */
+static int copy_extent (int fd, long long offset, long long len, u8 *raw, u8 *comp, u32 *crc)
+{
+	u8 rec[12];
+	int want;
+	int got;
+	int n;
+
+	memcpy (rec, "EXTN", 4);
+	put_be (rec + 4, offset, 8);
+	if (write (fd, rec, 12) < 12)
+		return -1;
+
+	for (; len > 0; len -= got, offset += got) {
+		want = (len > LDMZ_BLOCK) ? LDMZ_BLOCK : len;
+		got = dev_read (raw, offset, want);
+		if (got <= 0)
+			break;
+
+		*crc = ldmz_crc32 (*crc, raw, got);
+		n = ldmz_compress (raw, got, comp);
+		if (n >= got) {
+			memcpy (comp, raw, got);
+			n = got;
+		}
+
+		memcpy (rec, "BLCK", 4);
+		put_be (rec + 4, got, 4);
+		put_be (rec + 8, n,   4);
+		if ((write (fd, rec, 12) < 12) || (write (fd, comp, n) < n))
+			return -1;
+	}
+
+	memcpy (rec, "BLCK", 4);
+	put_be (rec + 4, 0, 8);
+	if (write (fd, rec, 12) < 12)
+		return -1;
+
+	return (len > 0) ? -1 : 0;
+}
+
+/**
+ * copy_compressed - Save the LDM Database to a single compressed file
+ *
+ * The result, NAME.ldmz, holds the same two extents as a .part / .data pair,
+ * along with the size of the device and a checksum.
+ */
+void copy_compressed (char *file, long long size)
+{
+	char name[64];
+	u8 *raw  = NULL;
+	u8 *comp = NULL;
+	u8 rec[LDMZ_HEADER];
+	u32 crc = 0;
+	int fd;
+
+	if (!file)
+		return;
+
+	sprintf (name, "%.58s.ldmz", basename (file));
+	fd = open64 (name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		printf ("Couldn't open output file: %s\n", name);
+		return;
+	}
+
+	raw  = kmalloc (LDMZ_BLOCK, GFP_KERNEL);
+	comp = kmalloc (LDMZ_BOUND (LDMZ_BLOCK), GFP_KERNEL);
+	if (!raw || !comp)
+		goto out;
+
+	memset (rec, 0, sizeof (rec));
+	memcpy (rec, LDMZ_MAGIC, 8);
+	put_be (rec + 8,  size, 8);
+	put_be (rec + 16, LDMZ_BLOCK, 4);
+	if (write (fd, rec, LDMZ_HEADER) < LDMZ_HEADER)
+		goto fail;
+
+	/* The partition table and primary PRIVHEAD, then the database */
+	if ((copy_extent (fd, 0, BUFSIZE, raw, comp, &crc) < 0) ||
+	    (copy_extent (fd, size - 1048576, 1048576, raw, comp, &crc) < 0))
+		goto fail;
+
+	memcpy (rec, "DONE", 4);
+	put_be (rec + 4, 2, 4);
+	put_be (rec + 8, crc, 4);
+	if (write (fd, rec, 12) < 12)
+		goto fail;
+
+	printf ("Successfully copied the LDM data to %s\n", name);
+	goto out;
+fail:
+	printf ("Couldn't write the compressed LDM data to %s\n", name);
+out:
+	kfree (raw);
+	kfree (comp);
+	close (fd);
+}
@@ -0,0 +1,443 @@
+/**
+ * ldminfo - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Richard Russon <ldm@flatcap.org>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ldminfo.h"
+
+/*
+ * A device is either a real disk (or a full-size image of one), or a capture
+ * made by "ldminfo --copy".  A capture is a pair of files, NAME.part holding
+ * the start of the disk and NAME.data holding the end of it.  Everything in
+ * between reads as zeros.
+ *
+ * A compressed capture, NAME.ldmz, is decompressed into memory when it's
+ * opened.  Its extents play the part of the .part and .data files.
+ */
+struct ldm_extent {
+	long long	start;		/* Disk offset of the extent */
+	long long	len;
+	u8		*data;
+};
+
+struct ldm_device {
+	int		fd;		/* The device, or the .part file */
+	int		fdata;		/* The .data file, or -1 */
+	long long	part_size;	/* Bytes held by the .part file */
+	long long	data_start;	/* Disk offset of the .data file */
+	long long	size;		/* Size of the (original) disk */
+	int		nmem;		/* Extents of a compressed capture */
+	int		inmem;		/* Read from mem[], not a file */
+	struct ldm_extent mem[LDMZ_EXTENTS];
+};
+
+static struct ldm_device dev = { -1, -1, 0, 0, 0, 0 };
+
+/**
+ * dev_pread - Read from a file at a given offset
+ *
+ * This doesn't move the file offset, so several threads can read at once.
+ */
+static int dev_pread (int fd, void *buf, long long offset, int len)
+{
+	return pread64 (fd, buf, len, offset);
+}
+
+/**
+ * dev_open_capture - Open a NAME.part / NAME.data pair as a virtual disk
+ *
+ * If @sectors is zero, the size of the original disk is taken from the
+ * primary PRIVHEAD, which the .part file always contains.
+ */
+static int dev_open_capture (char *part, long long sectors)
+{
+	u8 ph[512];
+	long long data_size;
+
+	dev.fd = open64 (part, O_RDONLY);
+	if (dev.fd < 0) {
+		printf ("Couldn't open capture (open): %s\n", part);
+		return -1;
+	}
+
+	strcpy (part + strlen (part) - 5, ".data");
+	dev.fdata = open64 (part, O_RDONLY);
+	if (dev.fdata < 0) {
+		printf ("Couldn't open capture (open): %s\n", part);
+		return -1;
+	}
+
+	dev.part_size = lseek64 (dev.fd,    0, SEEK_END);
+	data_size     = lseek64 (dev.fdata, 0, SEEK_END);
+	if ((dev.part_size < 0) || (data_size < 0)) {
+		printf ("Seek failed for capture: %s\n", part);
+		return -1;
+	}
+
+	if ((sectors == 0) &&
+	    (dev_pread (dev.fd, ph, 3072, sizeof (ph)) == sizeof (ph)) &&
+	    (strncmp (ph, "PRIVHEAD", 8) == 0))
+		sectors = BE64 (ph + 0x12B) + BE64 (ph + 0x133);
+
+	if (sectors == 0) {
+		printf ("Can't tell the size of the captured disk, please give it as NAME.part:SECTORS\n");
+		return -1;
+	}
+
+	dev.size       = sectors << 9;
+	dev.data_start = dev.size - data_size;
+	if (dev.data_start < dev.part_size) {
+		printf ("Capture is larger than the disk it came from: %s\n", part);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * ldmz_extent - Decompress one extent of a compressed capture
+ * @buf:  The whole .ldmz file
+ * @end:  Length of @buf
+ * @pos:  Offset of the extent's first block, updated to the record after it
+ * @ext:  Extent to fill in
+ *
+ * The blocks are walked twice, once to find the size of the extent, then
+ * again to decompress them.
+ */
+static int ldmz_extent (const u8 *buf, long long end, long long *pos, struct ldm_extent *ext)
+{
+	long long p;
+	long long out;
+	u32 len;
+	u32 stored;
+	int pass;
+
+	ext->len = 0;
+	for (pass = 0; pass < 2; pass++) {
+		for (p = *pos, out = 0; ; p += 12 + stored, out += len) {
+			if ((p + 12 > end) || (strncmp (buf + p, "BLCK", 4) != 0))
+				return -1;
+			len    = BE32 (buf + p + 4);
+			stored = BE32 (buf + p + 8);
+			if (len == 0)
+				break;
+			if ((len > LDMZ_BLOCK) || (stored > len) || (p + 12 + stored > end))
+				return -1;
+			if (!pass)
+				continue;
+			if (stored == len)
+				memcpy (ext->data + out, buf + p + 12, len);
+			else if (ldmz_decompress (buf + p + 12, stored, ext->data + out, len) < 0)
+				return -1;
+		}
+
+		if (!pass) {
+			ext->len  = out;
+			ext->data = kmalloc (out ? out : 1, GFP_KERNEL);
+			if (!ext->data)
+				return -1;
+		}
+	}
+
+	*pos = p + 12;
+	return 0;
+}
+
+/**
+ * dev_open_ldmz - Load a compressed capture into memory
+ *
+ * Every record is checked against the length of the file and the CRC of the
+ * decompressed data must match the one recorded in the trailer.
+ */
+static int dev_open_ldmz (const char *name)
+{
+	long long end;
+	long long pos;
+	u32 crc = 0;
+	u8 *buf;
+	int i;
+	int result = -1;
+
+	dev.fd = open64 (name, O_RDONLY);
+	if (dev.fd < 0) {
+		printf ("Couldn't open capture (open): %s\n", name);
+		return -1;
+	}
+
+	end = lseek64 (dev.fd, 0, SEEK_END);
+	if ((end < LDMZ_HEADER) || (end > (64 << 20))) {
+		printf ("Not a compressed capture: %s\n", name);
+		return -1;
+	}
+
+	buf = kmalloc (end, GFP_KERNEL);
+	if (!buf)
+		return -1;
+
+	if ((dev_pread (dev.fd, buf, 0, end) != end) ||
+	    (strncmp (buf, LDMZ_MAGIC, 8) != 0)) {
+		printf ("Not a compressed capture: %s\n", name);
+		goto out;
+	}
+
+	dev.size = BE64 (buf + 8);
+	if (dev.size < 0)
+		goto corrupt;
+
+	for (pos = LDMZ_HEADER; (pos + 12 <= end) && (strncmp (buf + pos, "EXTN", 4) == 0); ) {
+		struct ldm_extent *ext = &dev.mem[dev.nmem];
+
+		if (dev.nmem == LDMZ_EXTENTS)
+			goto corrupt;
+		ext->start = BE64 (buf + pos + 4);
+		ext->data  = NULL;
+		pos += 12;
+		dev.nmem++;
+		if ((ldmz_extent (buf, end, &pos, ext) < 0) ||
+		    (ext->start < 0) || (ext->start + ext->len > dev.size))
+			goto corrupt;
+		crc = ldmz_crc32 (crc, ext->data, ext->len);
+	}
+
+	if ((pos + 12 > end) || (strncmp (buf + pos, "DONE", 4) != 0) ||
+	    (BE32 (buf + pos + 4) != dev.nmem))
+		goto corrupt;
+
+	if (BE32 (buf + pos + 8) != crc) {
+		printf ("Checksum mismatch in compressed capture: %s\n", name);
+		goto out;
+	}
+
+	for (i = 1; i < dev.nmem; i++) {
+		if (dev.mem[i].start < dev.mem[i-1].start + dev.mem[i-1].len)
+			goto corrupt;
+	}
+
+	close (dev.fd);			/* Everything we need is in memory */
+	dev.fd    = -1;
+	dev.inmem = 1;
+	result = 0;
+	goto out;
+corrupt:
+	printf ("Compressed capture is corrupt: %s\n", name);
+out:
+	kfree (buf);
+	return result;
+}
+
+/**
+ * dev_open - Open a device, disk image or capture
+ * @name:  Device name, NAME.part[:SECTORS] or NAME.ldmz for a capture
+ * @size:  Returns the size of the device, in bytes
+ *
+ * Return:  0  Success
+ *         -1  Error, already logged
+ */
+int dev_open (const char *name, long long *size)
+{
+	struct stat64 st;
+	char path[256];
+	char *colon;
+	int len;
+
+	dev_close();
+
+	len = strlen (name);
+	if (len >= sizeof (path)) {
+		printf ("Device name is too long: %s\n", name);
+		return -1;
+	}
+	strcpy (path, name);
+
+	colon = strrchr (path, ':');
+	if (colon)
+		len = colon - path;
+
+	if ((len > 5) && (strncmp (path + len - 5, ".part", 5) == 0)) {
+		long long sectors = 0;
+
+		if (colon) {
+			*colon++ = 0;
+			sectors = strtoll (colon, NULL, 0);
+		}
+		if (dev_open_capture (path, sectors) < 0) {
+			dev_close();
+			return -1;
+		}
+		*size = dev.size;
+		return 0;
+	}
+
+	if ((len > 5) && (strcmp (path + len - 5, ".ldmz") == 0) && !colon) {
+		if (dev_open_ldmz (path) < 0) {
+			dev_close();
+			return -1;
+		}
+		*size = dev.size;
+		return 0;
+	}
+
+	if (stat64 (name, &st)) {
+		printf ("Couldn't open device (stat): %s\n", name);
+		return -1;
+	}
+
+	if ((!S_ISBLK (st.st_mode)) && (!S_ISREG (st.st_mode))) {
+		printf ("Couldn't open device (dev/file): %s\n", name);
+		return -1;
+	}
+
+	dev.fd = open64 (name, O_RDONLY);
+	if (dev.fd < 0) {
+		printf ("Couldn't open device (open): %s\n", name);
+		return -1;
+	}
+
+	dev.size = lseek64 (dev.fd, 0, SEEK_END);
+	if (dev.size < 0) {
+		printf ("Seek failed for device: %s\n", name);
+		dev_close();
+		return -1;
+	}
+
+	*size = dev.size;
+	return 0;
+}
+
+/**
+ * dev_close - Close the current device
+ */
+void dev_close (void)
+{
+	hedge_drain();
+	sector_cache_flush();
+
+	if (dev.fd >= 0)
+		close (dev.fd);
+	if (dev.fdata >= 0)
+		close (dev.fdata);
+	while (dev.nmem > 0) {
+		kfree (dev.mem[--dev.nmem].data);
+		dev.mem[dev.nmem].data = NULL;
+	}
+
+	dev.fd    = -1;
+	dev.fdata = -1;
+	dev.size  = 0;
+	dev.inmem = 0;
+}
+
+/**
+ * dev_read_mem - Read from a compressed capture
+ */
+static int dev_read_mem (u8 *buf, long long offset, int len)
+{
+	struct ldm_extent *ext;
+	long long n;
+	int done = 0;
+	int i;
+
+	if (len > dev.size - offset)
+		len = dev.size - offset;
+
+	while (len > 0) {
+		n = len;
+		for (i = 0, ext = dev.mem; i < dev.nmem; i++, ext++) {
+			if (offset < ext->start) {
+				n = min (n, ext->start - offset);
+				break;
+			}
+			if (offset < ext->start + ext->len)
+				break;
+		}
+
+		if ((i < dev.nmem) && (offset >= ext->start)) {
+			n = min (n, ext->start + ext->len - offset);
+			memcpy (buf, ext->data + (offset - ext->start), n);
+		} else {
+			memset (buf, 0, n);
+		}
+
+		buf    += n;
+		offset += n;
+		len    -= n;
+		done   += n;
+	}
+
+	return done;
+}
+
+/**
+ * dev_read - Read from the current device
+ * @buf:     Buffer to fill
+ * @offset:  Offset into the device, in bytes
+ * @len:     Number of bytes to read
+ *
+ * For a capture, each part of the request is mapped to the .part or .data
+ * file, or to an extent in memory, and the gaps are filled with zeros.
+ *
+ * Return:  n  Number of bytes read, zero at the end of the device
+ *         -1  Error, or the probe's budget has been spent
+ */
+int dev_read (void *buf, long long offset, int len)
+{
+	int done = 0;
+	int got;
+	int n;
+
+	if (!budget_read())
+		return -1;
+	throttle_read (len);
+
+	if (dev.inmem)
+		return dev_read_mem (buf, offset, len);
+
+	if (dev.fdata < 0)
+		return dev_pread (dev.fd, buf, offset, len);
+
+	while ((len > 0) && (offset < dev.size)) {
+		n = len;
+		if (offset < dev.part_size) {
+			if (n > dev.part_size - offset)
+				n = dev.part_size - offset;
+			got = dev_pread (dev.fd, buf, offset, n);
+		} else if (offset >= dev.data_start) {
+			got = dev_pread (dev.fdata, buf, offset - dev.data_start, n);
+		} else {
+			if (n > dev.data_start - offset)
+				n = dev.data_start - offset;
+			memset (buf, 0, n);
+			got = n;
+		}
+
+		if (got < 0)
+			return done ? done : -1;
+		if (got == 0)
+			break;
+
+		buf    += got;
+		offset += got;
+		len    -= got;
+		done   += got;
+	}
+
+	return done;
+}
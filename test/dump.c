@@ -29,19 +29,28 @@
 #endif
 
 /**
- * print_guid -
+ * print_guid - Format a binary GUID as text
+ *
+ * Each byte is two lookups rather than a trip through sprintf, which adds up
+ * when dumping a database with thousands of objects.
  */
 static char * print_guid (const u8 *block)
 {
+	static const char hex[] = "0123456789ABCDEF";
+	static const u8 dash[16] = { [3] = 1, [5] = 1, [7] = 1, [9] = 1 };
 	static char buffer[40];
-
-	memset (buffer, 0, sizeof (buffer));
+	char *p = buffer;
+	int i;
 
 	if (block) {
-		sprintf (buffer, "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
-			block[0], block[1], block[2],  block[3],  block[4],  block[5],  block[6],  block[7],
-			block[8], block[9], block[10], block[11], block[12], block[13], block[14], block[15]);
+		for (i = 0; i < 16; i++) {
+			*p++ = hex[block[i] >> 4];
+			*p++ = hex[block[i] & 15];
+			if (dash[i])
+				*p++ = '-';
+		}
 	}
+	*p = 0;
 
 	return buffer;
 }
@@ -133,6 +142,24 @@ static void dump_volume (struct vblk *vb)
 	}
 }
 
+/**
+ * dump_vblk - Display one VBLK, as a visitor for ldm_stream
+ */
+int dump_vblk (struct vblk *vb, void *arg)
+{
+	switch (vb->type) {
+	case VBLK_CMP3:	dump_component (vb); break;
+	case VBLK_PRT3:	dump_partition (vb); break;
+	case VBLK_DSK3:
+	case VBLK_DSK4:	dump_disk      (vb); break;
+	case VBLK_DGR3:
+	case VBLK_DGR4:	dump_diskgroup (vb); break;
+	case VBLK_VOL5:	dump_volume    (vb); break;
+	}
+
+	return LDM_VISIT_DROP;
+}
+
 /**
  * dump_vmdb -
  */
@@ -147,6 +174,8 @@ static int dump_vmdb (struct ldmdb *ldb)
 	printf ("VBLK Size          : 0x%X\n", vm->vblk_size);
 	printf ("Offset to VBLKs    : 0x%X\n", vm->vblk_offset);
 	printf ("Number of VBLKs    : 0x%X\n", vm->last_vblk_seq - (vm->vblk_offset / vm->vblk_size));
+	printf ("Committed Sequence : 0x%llX\n", (unsigned long long) vm->committed_seq);
+	printf ("Disk Group GUID    : %s\n", vm->dg_id);
 	printf ("\n");
 
 	printf ("VBLK DATABASE:\n");
@@ -291,12 +320,14 @@ static int dump_volumes (struct ldmdb *ldb)
  */
 void dump_database (char *name, struct ldmdb *ldb)
 {
+	struct ldmdb *db = ldm_group_db (ldb);	/* May be another disk's */
+
 	printf ("Device: %s\n\n", name);
 
 	dump_privhead (&ldb->ph);
-	dump_tocblock (&ldb->toc);
-	dump_vmdb (ldb);
-	dump_disks (ldb);
-	dump_volumes (ldb);
+	dump_tocblock (&db->toc);
+	dump_vmdb (db);
+	dump_disks (db);
+	dump_volumes (db);
 }
 
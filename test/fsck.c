@@ -0,0 +1,266 @@
+/**
+ * ldminfo - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Richard Russon <ldm@flatcap.org>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "ldminfo.h"
+
+/*
+ * Check a whole database, not just the parts needed for this disk.
+ *
+ * All the objects are put in one array, sorted by object id, so that every
+ * parent is found with a binary search, and each one counts its children as
+ * they're found.  The partitions are sorted by disk and start, so overlaps
+ * are found in one sweep.  Everything is O(n log n), even for a database
+ * with thousands of partitions.
+ */
+
+struct obj {
+	u64		id;
+	struct vblk	*vb;
+	int		kids;		/* Children that refer to it */
+};
+
+/**
+ * fsck_cmp_obj - Order objects by id
+ */
+static int fsck_cmp_obj (const void *a, const void *b)
+{
+	const struct obj *x = a;
+	const struct obj *y = b;
+
+	if (x->id != y->id)
+		return (x->id < y->id) ? -1 : 1;
+	return 0;
+}
+
+/**
+ * fsck_cmp_part - Order partitions by disk, then start
+ */
+static int fsck_cmp_part (const void *a, const void *b)
+{
+	const struct vblk_part *x = &(*(struct vblk * const *) a)->vblk.part;
+	const struct vblk_part *y = &(*(struct vblk * const *) b)->vblk.part;
+
+	if (x->disk_id != y->disk_id)
+		return (x->disk_id < y->disk_id) ? -1 : 1;
+	if (x->start != y->start)
+		return (x->start < y->start) ? -1 : 1;
+	return 0;
+}
+
+/**
+ * fsck_find - Binary search the objects for an id
+ */
+static struct obj * fsck_find (struct obj *objs, int count, u64 id)
+{
+	int lo = 0;
+	int hi = count;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (objs[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo < count) && (objs[lo].id == id))
+		return objs + lo;
+	return NULL;
+}
+
+/**
+ * fsck_add - Add every VBLK in a list to the array
+ */
+static int fsck_add (struct list_head *head, struct obj *objs, int count)
+{
+	struct list_head *item;
+
+	list_for_each (item, head) {
+		if (objs) {
+			objs[count].vb   = list_entry (item, struct vblk, list);
+			objs[count].id   = objs[count].vb->obj_id;
+			objs[count].kids = 0;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * fsck_is_disk - Is the VBLK a disk?
+ */
+static int fsck_is_disk (const struct obj *o)
+{
+	return o && ((o->vb->type == VBLK_DSK3) || (o->vb->type == VBLK_DSK4));
+}
+
+/**
+ * check_database - Check the references and extents of the whole database
+ * @name:  Name of the device, for the report
+ * @ldb:   This disk's database
+ *
+ * The database may have been read from another disk of the group.  Each
+ * problem is reported on a line of its own.
+ *
+ * Return:  n  The number of problems found
+ *         -1  Out of memory
+ */
+int check_database (char *name, struct ldmdb *ldb)
+{
+	struct ldmdb *db = ldm_group_db (ldb);	/* May be another disk's */
+	struct obj *objs = NULL;
+	struct vblk **parts = NULL;
+	struct vblk *this_disk;
+	struct vblk *last = NULL;
+	struct obj *o;
+	u64 end = 0;
+	int count, nparts, i;
+	int problems = 0;
+
+	printf ("Checking %s\n", name);
+
+	count  = fsck_add (&db->v_dgrp, NULL, 0);
+	count  = fsck_add (&db->v_disk, NULL, count);
+	count  = fsck_add (&db->v_volu, NULL, count);
+	count  = fsck_add (&db->v_comp, NULL, count);
+	nparts = fsck_add (&db->v_part, NULL, 0);
+
+	objs  = kmalloc ((count + nparts + 1) * sizeof (*objs),  GFP_KERNEL);
+	parts = kmalloc ((nparts + 1)         * sizeof (*parts), GFP_KERNEL);
+	if (!objs || !parts) {
+		printk (LDM_CRIT "%s(): Out of memory.\n", __FUNCTION__);
+		problems = -1;
+		goto out;
+	}
+
+	i = fsck_add (&db->v_dgrp, objs, 0);
+	i = fsck_add (&db->v_disk, objs, i);
+	i = fsck_add (&db->v_volu, objs, i);
+	i = fsck_add (&db->v_comp, objs, i);
+	i = fsck_add (&db->v_part, objs, i);
+	for (i = 0; i < nparts; i++)
+		parts[i] = objs[count + i].vb;
+	count += nparts;
+
+	qsort (objs, count, sizeof (*objs), fsck_cmp_obj);
+	qsort (parts, nparts, sizeof (*parts), fsck_cmp_part);
+
+	for (i = 1; i < count; i++) {
+		if (objs[i].id != objs[i-1].id)
+			continue;
+		printf ("  Object id 0x%llx is used by both '%s' and '%s'\n",
+			objs[i].id, objs[i-1].vb->name, objs[i].vb->name);
+		problems++;
+	}
+
+	/* Each child finds its parent, and is counted */
+	for (i = 0; i < count; i++) {
+		struct vblk *vb = objs[i].vb;
+
+		if (vb->type == VBLK_PRT3) {
+			o = fsck_find (objs, count, vb->vblk.part.parent_id);
+			if (o && (o->vb->type == VBLK_CMP3)) {
+				o->kids++;
+			} else {
+				printf ("  Partition '%s' has no component 0x%llx\n",
+					vb->name, vb->vblk.part.parent_id);
+				problems++;
+			}
+
+			o = fsck_find (objs, count, vb->vblk.part.disk_id);
+			if (!fsck_is_disk (o)) {
+				printf ("  Partition '%s' has no disk 0x%llx\n",
+					vb->name, vb->vblk.part.disk_id);
+				problems++;
+			}
+		} else if (vb->type == VBLK_CMP3) {
+			o = fsck_find (objs, count, vb->vblk.comp.parent_id);
+			if (o && (o->vb->type == VBLK_VOL5)) {
+				o->kids++;
+			} else {
+				printf ("  Component '%s' has no volume 0x%llx\n",
+					vb->name, vb->vblk.comp.parent_id);
+				problems++;
+			}
+		}
+	}
+
+	/* The parents must have the children they say they have.  The
+	 * component's count is only kept as a byte. */
+	for (i = 0; i < count; i++) {
+		struct vblk *vb = objs[i].vb;
+
+		if ((vb->type == VBLK_CMP3) &&
+		    ((u8) objs[i].kids != vb->vblk.comp.children)) {
+			printf ("  Component '%s' has %d partitions, not %d\n",
+				vb->name, objs[i].kids, vb->vblk.comp.children);
+			problems++;
+		} else if ((vb->type == VBLK_VOL5) && (objs[i].kids == 0)) {
+			printf ("  Volume '%s' has no components\n", vb->name);
+			problems++;
+		}
+	}
+
+	/* Sweep each disk's partitions, in order of their start */
+	this_disk = ldm_get_disk_objid (db, ldb->ph.disk_id);
+	for (i = 0; i < nparts; i++) {
+		struct vblk_part *part = &parts[i]->vblk.part;
+
+		if (!last || (last->vblk.part.disk_id != part->disk_id)) {
+			last = NULL;
+			end  = 0;
+		}
+
+		if (last && (part->start < end)) {
+			o = fsck_find (objs, count, part->disk_id);
+			printf ("  Partitions '%s' and '%s' overlap on disk '%s'\n",
+				last->name, parts[i]->name,
+				fsck_is_disk (o) ? (char *) o->vb->name : "?");
+			problems++;
+		}
+
+		if (!last || (part->start + part->size > end)) {
+			last = parts[i];
+			end  = part->start + part->size;
+		}
+
+		if (this_disk && (part->disk_id == this_disk->obj_id) &&
+		    (part->start + part->size > ldb->ph.logical_disk_size)) {
+			printf ("  Partition '%s' is beyond the end of the disk\n",
+				parts[i]->name);
+			problems++;
+		}
+	}
+
+	if (problems)
+		printf ("%d problem(s) found\n\n", problems);
+	else
+		printf ("No problems found\n\n");
+out:
+	kfree (objs);
+	kfree (parts);
+	return problems;
+}
@@ -0,0 +1,184 @@
+/**
+ * ldminfo - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Richard Russon <ldm@flatcap.org>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "ldminfo.h"
+
+/*
+ * Hedged reads of the redundant headers.
+ *
+ * The PRIVHEAD and TOCBLOCK backups are read at the same time, one thread
+ * each.  We wait for them, but only for --hedge=MS milliseconds.  Any still
+ * outstanding after that are reported as late and the probe carries on
+ * without them, so a disk with one slow or retrying sector doesn't stall.
+ *
+ * A late read is never cancelled.  Its thread owns a reference to the buffers
+ * and frees them when it finishes.  dev_close waits for any that are left,
+ * because they still read from the device.
+ */
+
+void *	malloc	(size_t size);
+void	free	(void *ptr);
+
+#define HEDGE_COPIES	8		/* Most copies read at once */
+
+enum {					/* State of one read */
+	READ_RUNNING = 0,
+	READ_DONE,
+	READ_ABANDONED			/* Late: the caller has given up on it */
+};
+
+struct hedge;
+
+struct hedge_read {
+	struct hedge	*h;
+	long long	offset;
+	int		got;
+	volatile int	state;
+	u8		data[512];
+};
+
+struct hedge {
+	int			refs;	/* The caller, and each thread */
+	struct hedge_read	r[HEDGE_COPIES];
+};
+
+int ldm_hedge_ms   = 0;		/* How long to wait for the copies */
+int ldm_hedge_late = 0;		/* Reads that were late */
+
+static volatile int hedge_pending = 0;	/* Late reads that are still running */
+
+/**
+ * hedge_put - Drop a reference to a set of reads
+ */
+static void hedge_put (struct hedge *h)
+{
+	if (__sync_sub_and_fetch (&h->refs, 1) == 0)
+		free (h);
+}
+
+/**
+ * hedge_read - Thread: read one copy
+ */
+static void * hedge_read (void *arg)
+{
+	struct hedge_read *r = arg;
+
+	printk_quiet = 1;
+	r->got = dev_read (r->data, r->offset, 512);
+
+	if (!__sync_bool_compare_and_swap (&r->state, READ_RUNNING, READ_DONE))
+		__sync_sub_and_fetch (&hedge_pending, 1);	/* Too late */
+
+	hedge_put (r->h);
+	return NULL;
+}
+
+/**
+ * hedge_read_copies - Read the copies of a header, giving up on slow ones
+ *
+ * This is ldm_read_copies_hook.
+ */
+void hedge_read_copies (struct block_device *bdev, unsigned long base,
+			const int *off, int count, u8 *buf, int *state)
+{
+	struct hedge_read *r;
+	struct hedge *h;
+	int waited;
+	int i;
+
+	h = malloc (sizeof (*h));
+	if (!h || (count > HEDGE_COPIES)) {
+		free (h);
+		for (i = 0; i < count; i++) {		/* Do it the slow way */
+			if (dev_read (buf + (i << 9), ((long long) (base + off[i])) << 9, 512) < 512)
+				state[i] = COPY_FAILED;
+			else
+				state[i] = COPY_OK;
+		}
+		return;
+	}
+
+	h->refs = 1;
+	for (i = 0; i < count; i++) {
+		r = h->r + i;
+		r->h      = h;
+		r->offset = ((long long) (base + off[i])) << 9;
+		r->state  = READ_RUNNING;
+
+		__sync_add_and_fetch (&h->refs, 1);
+		if (!thread_detach (hedge_read, r))
+			hedge_read (r);			/* Do it ourselves */
+	}
+
+	for (waited = 0; waited < ldm_hedge_ms; waited++) {
+		for (i = 0; i < count; i++)
+			if (h->r[i].state == READ_RUNNING)
+				break;
+		if (i == count)
+			break;
+		usleep (1000);
+	}
+
+	for (i = 0; i < count; i++) {
+		r = h->r + i;
+		__sync_add_and_fetch (&hedge_pending, 1);
+		if (__sync_bool_compare_and_swap (&r->state, READ_RUNNING, READ_ABANDONED)) {
+			state[i] = COPY_LATE;
+			ldm_hedge_late++;
+			if (debug)
+				printf ("Sector %llu was late, after %d ms.\n",
+					r->offset >> 9, waited);
+			continue;
+		}
+		__sync_sub_and_fetch (&hedge_pending, 1);
+
+		if (r->got < 512) {
+			state[i] = COPY_FAILED;
+		} else {
+			memcpy (buf + (i << 9), r->data, 512);
+			state[i] = COPY_OK;
+		}
+	}
+
+	hedge_put (h);
+}
+
+/**
+ * hedge_drain - Wait for the late reads to finish
+ */
+void hedge_drain (void)
+{
+	int waited = 0;
+
+	if (!hedge_pending)
+		return;
+
+	while (hedge_pending > 0) {
+		usleep (1000);
+		waited++;
+	}
+
+	if (debug)
+		printf ("Waited %d ms more for the late reads.\n", waited);
+}
@@ -0,0 +1,557 @@
+/**
+ * ldmarc - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Richard Russon <ldm@flatcap.org>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * An archive of many captures made by "ldminfo --copy".
+ *
+ * Every disk in a disk group carries a copy of the same database, so the
+ * captures are stored content-addressed: each distinct sector is kept once,
+ * and every disk has a manifest listing which stored sector makes up each of
+ * its sectors.  All numbers are big-endian.
+ *
+ *	Header		"LDMARC01", sector size, number of disks, number of
+ *			stored sectors, offset of the index
+ *	Sector pool	The distinct sectors, 512 bytes each
+ *	Manifests	One per disk, see struct manifest, followed by the
+ *			pool numbers of its .part and .data sectors
+ *	Index		The name and manifest offset of each disk
+ *
+ * An all-zero sector isn't stored at all, it's recorded as ARC_ZERO.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#define ARC_MAGIC	"LDMARC01"
+#define ARC_SECTOR	512
+#define ARC_ZERO	0xFFFFFFFF	/* Pool number of an empty sector */
+#define ARC_NAME	64
+#define ARC_GUID	40
+
+#define PRIVHEAD_OFF	3072		/* Primary PRIVHEAD in the .part file */
+
+typedef unsigned char		u8;
+typedef unsigned int		u32;
+typedef unsigned long long	u64;
+
+struct header {				/* Archive header, at offset 0 */
+	char	magic[8];
+	u8	sector_size[4];
+	u8	num_disks[4];
+	u8	num_sectors[4];
+	u8	index[8];
+};
+
+struct manifest {			/* Per-disk manifest */
+	char	name[ARC_NAME];
+	char	disk_id[ARC_GUID];	/* Disk GUID, from the PRIVHEAD */
+	u8	sectors[8];		/* Size of the original disk */
+	u8	disk_start[8];		/* PRIVHEAD's logical disk */
+	u8	disk_size[8];
+	u8	config_start[8];	/* PRIVHEAD's database */
+	u8	config_size[8];
+	u8	part_sectors[4];	/* Length of the .part file */
+	u8	data_sectors[4];	/* Length of the .data file */
+};
+
+struct entry {				/* Index entry */
+	char	name[ARC_NAME];
+	u8	manifest[8];
+};
+
+struct pool {				/* Distinct sectors while creating */
+	u8	*data;
+	u32	count;
+	u32	alloc;
+	u32	*hash;			/* Open addressing, pool number + 1 */
+	u32	mask;
+};
+
+static void put32 (u8 *p, u32 v) { int i; for (i = 3; i >= 0; i--, v >>= 8) p[i] = v; }
+static void put64 (u8 *p, u64 v) { int i; for (i = 7; i >= 0; i--, v >>= 8) p[i] = v; }
+static u32  get32 (const u8 *p)  { u32 v = 0; int i; for (i = 0; i < 4; i++) v = (v << 8) | p[i]; return v; }
+static u64  get64 (const u8 *p)  { u64 v = 0; int i; for (i = 0; i < 8; i++) v = (v << 8) | p[i]; return v; }
+
+/**
+ * sector_hash - FNV-1a hash of one sector
+ */
+static u32 sector_hash (const u8 *sect)
+{
+	u64 h = 0xcbf29ce484222325ULL;
+	int i;
+
+	for (i = 0; i < ARC_SECTOR; i++)
+		h = (h ^ sect[i]) * 0x100000001b3ULL;
+
+	return h ^ (h >> 32);
+}
+
+/**
+ * pool_grow - Double the size of the hash table and rehash
+ */
+static int pool_grow (struct pool *pool)
+{
+	u32 size = (pool->mask + 1) * 2;
+	u32 *hash;
+	u32 i, h;
+
+	hash = calloc (size, sizeof (*hash));
+	if (!hash)
+		return -1;
+
+	for (i = 0; i < pool->count; i++) {
+		h = sector_hash (pool->data + (u64) i * ARC_SECTOR) & (size - 1);
+		while (hash[h])
+			h = (h + 1) & (size - 1);
+		hash[h] = i + 1;
+	}
+
+	free (pool->hash);
+	pool->hash = hash;
+	pool->mask = size - 1;
+	return 0;
+}
+
+/**
+ * pool_add - Find a sector in the pool, adding it if it's new
+ *
+ * Return:  n         Pool number of the sector
+ *          ARC_ZERO  The sector is empty
+ *          -1        Out of memory
+ */
+static long long pool_add (struct pool *pool, const u8 *sect)
+{
+	u32 h, n;
+	int i;
+
+	for (i = 0; i < ARC_SECTOR; i++)
+		if (sect[i])
+			break;
+	if (i == ARC_SECTOR)
+		return ARC_ZERO;
+
+	if (((pool->count + 1) * 2 > pool->mask) && (pool_grow (pool) < 0))
+		return -1;
+
+	for (h = sector_hash (sect) & pool->mask; (n = pool->hash[h]); h = (h + 1) & pool->mask)
+		if (memcmp (pool->data + (u64) (n - 1) * ARC_SECTOR, sect, ARC_SECTOR) == 0)
+			return n - 1;
+
+	if (pool->count == pool->alloc) {
+		u32 alloc = pool->alloc ? pool->alloc * 2 : 4096;
+		u8 *data = realloc (pool->data, (u64) alloc * ARC_SECTOR);
+		if (!data)
+			return -1;
+		pool->data  = data;
+		pool->alloc = alloc;
+	}
+
+	memcpy (pool->data + (u64) pool->count * ARC_SECTOR, sect, ARC_SECTOR);
+	pool->hash[h] = pool->count + 1;
+	return pool->count++;
+}
+
+/**
+ * read_file - Read a whole file into memory, padded to a sector
+ */
+static u8 * read_file (const char *name, u32 *sectors)
+{
+	FILE *f;
+	u8 *buf;
+	long size;
+
+	f = fopen (name, "rb");
+	if (!f) {
+		printf ("Cannot open '%s'\n", name);
+		return NULL;
+	}
+
+	fseek (f, 0, SEEK_END);
+	size = ftell (f);
+	rewind (f);
+
+	*sectors = (size + ARC_SECTOR - 1) / ARC_SECTOR;
+	buf = calloc (*sectors + 1, ARC_SECTOR);
+	if (buf && (fread (buf, 1, size, f) != size)) {
+		printf ("Cannot read '%s'\n", name);
+		free (buf);
+		buf = NULL;
+	}
+
+	fclose (f);
+	return buf;
+}
+
+/**
+ * capture_name - Strip any .part suffix from a capture's name
+ */
+static void capture_name (char *dest, const char *src)
+{
+	int len;
+
+	snprintf (dest, ARC_NAME, "%s", src);
+	len = strlen (dest);
+	if ((len > 5) && (strcmp (dest + len - 5, ".part") == 0))
+		dest[len - 5] = 0;
+}
+
+/**
+ * add_capture - Add one capture to the archive
+ *
+ * The .part and .data sectors are added to the pool, then the disk's manifest
+ * is written to @out.
+ */
+static int add_capture (FILE *out, struct pool *pool, const char *arg, struct entry *ent)
+{
+	char name[ARC_NAME + 8];
+	struct manifest man;
+	u8 *part = NULL;
+	u8 *data = NULL;
+	u8 *map  = NULL;
+	u8 *ph;
+	u32 psects, dsects, i;
+	long long n;
+	int result = -1;
+
+	memset (&man, 0, sizeof (man));
+	capture_name (man.name, arg);
+
+	sprintf (name, "%s.part", man.name);
+	part = read_file (name, &psects);
+	sprintf (name, "%s.data", man.name);
+	data = read_file (name, &dsects);
+	if (!part || !data)
+		goto out;
+
+	ph = part + PRIVHEAD_OFF;
+	if ((psects * ARC_SECTOR > PRIVHEAD_OFF) && (memcmp (ph, "PRIVHEAD", 8) == 0)) {
+		memcpy (man.disk_id, ph + 0x30, 36);
+		memcpy (man.disk_start,   ph + 0x11B, 8);
+		memcpy (man.disk_size,    ph + 0x123, 8);
+		memcpy (man.config_start, ph + 0x12B, 8);
+		memcpy (man.config_size,  ph + 0x133, 8);
+		put64 (man.sectors, get64 (ph + 0x12B) + get64 (ph + 0x133));
+	} else {
+		printf ("Warning: '%s' has no PRIVHEAD\n", man.name);
+	}
+	put32 (man.part_sectors, psects);
+	put32 (man.data_sectors, dsects);
+
+	map = malloc ((psects + dsects) * 4);
+	if (!map)
+		goto out;
+
+	for (i = 0; i < psects + dsects; i++) {
+		if (i < psects)
+			n = pool_add (pool, part + i * ARC_SECTOR);
+		else
+			n = pool_add (pool, data + (i - psects) * ARC_SECTOR);
+		if (n < 0) {
+			printf ("Out of memory\n");
+			goto out;
+		}
+		put32 (map + i * 4, n);
+	}
+
+	memcpy (ent->name, man.name, ARC_NAME);
+	put64 (ent->manifest, ftello (out));
+
+	if ((fwrite (&man, sizeof (man), 1, out) != 1) ||
+	    (fwrite (map, 4, psects + dsects, out) != psects + dsects)) {
+		printf ("Cannot write the manifest for '%s'\n", man.name);
+		goto out;
+	}
+
+	result = 0;
+out:
+	free (part);
+	free (data);
+	free (map);
+	return result;
+}
+
+/**
+ * arc_create - Create an archive from a list of captures
+ *
+ * The manifests are written to a temporary file while the pool is built, then
+ * copied after the pool once it's complete.
+ */
+static int arc_create (const char *file, int count, char *names[])
+{
+	struct header hdr;
+	struct entry *index;
+	struct pool pool;
+	FILE *out = NULL;
+	FILE *tmp = NULL;
+	char buf[4096];
+	long long base;
+	size_t got;
+	int result = 1;
+	int i;
+
+	memset (&pool, 0, sizeof (pool));
+	pool.mask = 4095;
+	pool.hash = calloc (pool.mask + 1, sizeof (*pool.hash));
+	index = calloc (count, sizeof (*index));
+	tmp = tmpfile();
+	if (!pool.hash || !index || !tmp) {
+		printf ("Out of memory\n");
+		goto out;
+	}
+
+	for (i = 0; i < count; i++)
+		if (add_capture (tmp, &pool, names[i], &index[i]) < 0)
+			goto out;
+
+	out = fopen (file, "wb");
+	if (!out) {
+		printf ("Cannot create '%s'\n", file);
+		goto out;
+	}
+
+	base = sizeof (hdr) + (long long) pool.count * ARC_SECTOR;
+
+	memset (&hdr, 0, sizeof (hdr));
+	memcpy (hdr.magic, ARC_MAGIC, sizeof (hdr.magic));
+	put32 (hdr.sector_size, ARC_SECTOR);
+	put32 (hdr.num_disks,   count);
+	put32 (hdr.num_sectors, pool.count);
+	put64 (hdr.index, base + ftello (tmp));
+
+	/* Manifest offsets were relative to the temporary file */
+	for (i = 0; i < count; i++)
+		put64 (index[i].manifest, base + get64 (index[i].manifest));
+
+	if ((fwrite (&hdr, sizeof (hdr), 1, out) != 1) ||
+	    (fwrite (pool.data, ARC_SECTOR, pool.count, out) != pool.count))
+		goto write_error;
+
+	rewind (tmp);
+	while ((got = fread (buf, 1, sizeof (buf), tmp)) > 0)
+		if (fwrite (buf, 1, got, out) != got)
+			goto write_error;
+
+	if ((fwrite (index, sizeof (*index), count, out) != count) ||
+	    (fclose (out) != 0)) {
+		out = NULL;
+		goto write_error;
+	}
+	out = NULL;
+
+	printf ("Archived %d disk%s, %u distinct sectors\n", count,
+		(count > 1) ? "s" : "", pool.count);
+	result = 0;
+	goto out;
+
+write_error:
+	printf ("Cannot write to '%s': %s\n", file, strerror (errno));
+out:
+	if (out)
+		fclose (out);
+	if (tmp)
+		fclose (tmp);
+	free (pool.data);
+	free (pool.hash);
+	free (index);
+	return result;
+}
+
+/**
+ * arc_open - Open an archive and read its header and index
+ */
+static FILE * arc_open (const char *file, struct header *hdr, struct entry **index)
+{
+	FILE *f;
+	u32 count;
+
+	f = fopen (file, "rb");
+	if (!f) {
+		printf ("Cannot open '%s'\n", file);
+		return NULL;
+	}
+
+	if ((fread (hdr, sizeof (*hdr), 1, f) != 1) ||
+	    (memcmp (hdr->magic, ARC_MAGIC, sizeof (hdr->magic)) != 0) ||
+	    (get32 (hdr->sector_size) != ARC_SECTOR)) {
+		printf ("'%s' isn't an LDM archive\n", file);
+		fclose (f);
+		return NULL;
+	}
+
+	count = get32 (hdr->num_disks);
+	*index = calloc (count + 1, sizeof (**index));
+	if (!*index ||
+	    (fseeko (f, get64 (hdr->index), SEEK_SET) < 0) ||
+	    (fread (*index, sizeof (**index), count, f) != count)) {
+		printf ("Cannot read the index of '%s'\n", file);
+		free (*index);
+		fclose (f);
+		return NULL;
+	}
+
+	return f;
+}
+
+/**
+ * arc_list - List the disks in an archive
+ */
+static int arc_list (const char *file)
+{
+	struct header hdr;
+	struct manifest man;
+	struct entry *index;
+	FILE *f;
+	u32 i;
+
+	f = arc_open (file, &hdr, &index);
+	if (!f)
+		return 1;
+
+	printf ("Name                             Disk Id                                   Sectors\n");
+	for (i = 0; i < get32 (hdr.num_disks); i++) {
+		if ((fseeko (f, get64 (index[i].manifest), SEEK_SET) < 0) ||
+		    (fread (&man, sizeof (man), 1, f) != 1)) {
+			printf ("Cannot read the manifest for '%.64s'\n", index[i].name);
+			break;
+		}
+		printf ("%-32.32s %-36.36s %12llu\n", man.name, man.disk_id,
+			get64 (man.sectors));
+	}
+	printf ("%u distinct sectors\n", get32 (hdr.num_sectors));
+
+	free (index);
+	fclose (f);
+	return 0;
+}
+
+/**
+ * write_sectors - Write part of a manifest's sectors out to a file
+ */
+static int write_sectors (FILE *f, const u8 *map, u32 count, const char *name)
+{
+	u8 sect[ARC_SECTOR];
+	FILE *out;
+	u32 n;
+	u32 i;
+
+	out = fopen (name, "wb");
+	if (!out) {
+		printf ("Cannot create '%s'\n", name);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		n = get32 (map + i * 4);
+		if (n == ARC_ZERO)
+			memset (sect, 0, sizeof (sect));
+		else if ((fseeko (f, sizeof (struct header) + (long long) n * ARC_SECTOR, SEEK_SET) < 0) ||
+			 (fread (sect, sizeof (sect), 1, f) != 1))
+			break;
+		if (fwrite (sect, sizeof (sect), 1, out) != 1)
+			break;
+	}
+
+	if ((fclose (out) != 0) || (i < count)) {
+		printf ("Cannot write '%s'\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * arc_extract - Recreate the .part and .data files of some, or all, disks
+ */
+static int arc_extract (const char *file, int count, char *names[])
+{
+	char name[ARC_NAME + 8];
+	struct header hdr;
+	struct manifest man;
+	struct entry *index;
+	u32 psects, dsects;
+	u8 *map;
+	FILE *f;
+	int failed = 0;
+	int found;
+	u32 i;
+	int j;
+
+	f = arc_open (file, &hdr, &index);
+	if (!f)
+		return 1;
+
+	for (i = 0; i < get32 (hdr.num_disks); i++) {
+		for (found = !count, j = 0; !found && (j < count); j++) {
+			capture_name (name, names[j]);
+			found = (strncmp (name, index[i].name, ARC_NAME) == 0);
+		}
+		if (!found)
+			continue;
+
+		if ((fseeko (f, get64 (index[i].manifest), SEEK_SET) < 0) ||
+		    (fread (&man, sizeof (man), 1, f) != 1)) {
+			printf ("Cannot read the manifest for '%.64s'\n", index[i].name);
+			failed++;
+			continue;
+		}
+
+		psects = get32 (man.part_sectors);
+		dsects = get32 (man.data_sectors);
+		map = malloc ((psects + dsects) * 4);
+		if (!map || (fread (map, 4, psects + dsects, f) != psects + dsects)) {
+			printf ("Cannot read the manifest for '%.64s'\n", man.name);
+			free (map);
+			failed++;
+			continue;
+		}
+
+		sprintf (name, "%.64s.part", man.name);
+		failed += (write_sectors (f, map, psects, name) < 0);
+		sprintf (name, "%.64s.data", man.name);
+		failed += (write_sectors (f, map + psects * 4, dsects, name) < 0);
+		free (map);
+	}
+
+	free (index);
+	fclose (f);
+	return failed ? 1 : 0;
+}
+
+int main (int argc, char *argv[])
+{
+	if ((argc >= 4) && (strcmp (argv[1], "-c") == 0))
+		return arc_create (argv[2], argc - 3, argv + 3);
+	if ((argc == 3) && (strcmp (argv[1], "-l") == 0))
+		return arc_list (argv[2]);
+	if ((argc >= 3) && (strcmp (argv[1], "-x") == 0))
+		return arc_extract (argv[2], argc - 3, argv + 3);
+
+	printf ("\nUsage:\n"
+		"\t%s -c archive capture ...\tArchive captures (NAME or NAME.part)\n"
+		"\t%s -l archive\t\t\tList the disks in an archive\n"
+		"\t%s -x archive [capture ...]\tExtract some, or all, captures\n\n",
+		basename (argv[0]), basename (argv[0]), basename (argv[0]));
+	return 1;
+}
@@ -60,41 +60,125 @@ void dump_info (char *name, struct parsed_partitions *pp)
 	printf ("\n");
 }
 
+/**
+ * skip_device - Say why a device couldn't be read
+ */
+static void skip_device (char *name)
+{
+	if (ldm_budget_spent)
+		printf ("Gave up on device '%s': %s\n", name, ldm_budget_spent);
+	else
+		printf ("Something went wrong, skipping device '%s'\n", name);
+}
+
 /**
  * main - ldminfo entry point
  */
 int main (int argc, char *argv[])
 {
 	int a;
+	int result;
 	int info  = 0;
 	int dump  = 0;
+	int check = 0;
+	int problems = 0;
 	int copy  = 0;
+	int comp  = 0;
+	int strm  = 0;
+	int thrd  = 0;
+	int hedg  = 0;
+	int bdgt  = 0;
+	int ioc   = 0;
+	int prb   = 0;
+	int lkup  = 0;
+	const char *ioclass = NULL;
+	const char *lookup = NULL;
 	int help  = 0;
 	int ver   = 0;
 	struct block_device bdev;
 	struct inode ino;
-	struct stat64 st;
+	struct ldmdb **ldbs;
 
 	for (a = 1; a < argc; a++) {
 		if	(strcmp (argv[a], "--info")    == 0) info++;
 		else if	(strcmp (argv[a], "--dump")    == 0) dump++;
+		else if	(strcmp (argv[a], "--check")   == 0) check++;
 		else if (strcmp (argv[a], "--copy")    == 0) copy++;
+		else if (strcmp (argv[a], "--compress")== 0) comp++;
+		else if (strcmp (argv[a], "--stream")  == 0) strm++;
 		else if (strcmp (argv[a], "--debug")   == 0) debug++;
 		else if (strcmp (argv[a], "--help")    == 0) help++;
 		else if (strcmp (argv[a], "--version") == 0) ver++;
+		else if (strncmp (argv[a], "--threads=", 10) == 0) {
+			ldm_threads = strtoll (argv[a] + 10, NULL, 0);
+			thrd++;
+		}
+		else if (strncmp (argv[a], "--hedge=", 8) == 0) {
+			ldm_hedge_ms = strtoll (argv[a] + 8, NULL, 0);
+			hedg++;
+		}
+		else if (strncmp (argv[a], "--probe=", 8) == 0) {
+			ldm_probe_list = argv[a] + 8;
+			prb++;
+		}
+		else if (strncmp (argv[a], "--lookup=", 9) == 0) {
+			lookup = argv[a] + 9;
+			lkup++;
+		}
+		else if (strncmp (argv[a], "--iops=", 7) == 0) {
+			ldm_limit_iops = strtoll (argv[a] + 7, NULL, 0);
+			ioc++;
+		}
+		else if (strncmp (argv[a], "--bw=", 5) == 0) {
+			ldm_limit_bw = strtoll (argv[a] + 5, NULL, 0);
+			ioc++;
+		}
+		else if (strncmp (argv[a], "--ioclass=", 10) == 0) {
+			ioclass = argv[a] + 10;
+			ioc++;
+		}
+		else if (strncmp (argv[a], "--max-time=", 11) == 0) {
+			ldm_budget_secs = strtoll (argv[a] + 11, NULL, 0);
+			bdgt++;
+		}
+		else if (strncmp (argv[a], "--max-reads=", 12) == 0) {
+			ldm_budget_reads = strtoll (argv[a] + 12, NULL, 0);
+			bdgt++;
+		}
+		else if (strncmp (argv[a], "--max-mem=", 10) == 0) {
+			ldm_budget_mem = strtoll (argv[a] + 10, NULL, 0);
+			bdgt++;
+		}
 		else continue;
 		argv[a][0] = 0;
 	}
 
-	if (help || (argc - info - dump - copy - debug) < 2) {
+	if (help || (argc - info - dump - check - copy - comp - strm - thrd - hedg - bdgt - ioc - prb - lkup - debug) < 2) {
 		printf ("\nUsage:\n    %s [options] device ...\n", basename (argv[0]));
 		printf ("\nOptions:\n"
 			"    --info     A concise list of partitions (default)\n"
 			"    --dump     The contents of the database in detail\n"
+			"    --check    Check the whole database for broken references\n"
+			"               and overlapping partitions\n"
+			"    --stream   List the VBLKs as they are read, using little memory\n"
 			"    --copy     Write the database to a file\n"
+			"    --compress With --copy, write a single compressed file\n"
+			"    --threads=N  Decode the VBLKs with N threads\n"
+			"    --hedge=MS Read the backup headers at once, waiting MS for each\n"
+			"    --max-time=SECS  Give up on a device after SECS seconds\n"
+			"    --max-reads=N    Give up on a device after N reads\n"
+			"    --max-mem=BYTES  Give up on a device that needs more memory\n"
+			"    --probe=LIST     Only probe these devices (sda,sdb) or not (!sdc)\n"
+			"    --lookup=FILE    Say which partition and volume holds each sector\n"
+			"                     listed in FILE (- for stdin)\n"
+			"    --iops=N         Read at most N times a second\n"
+			"    --bw=BYTES       Read at most BYTES a second\n"
+			"    --ioclass=CLASS  Use the idle or best-effort I/O priority\n"
 			"    --debug    Display lots of debugging information\n"
 			"    --version  display the version number\n"
-			"    --help     Show this short help\n\n");
+			"    --help     Show this short help\n\n"
+			"A capture made by --copy can be read in place as NAME.part[:SECTORS]\n"
+			"or NAME.ldmz\n\n");
 		return 1;
 	}
 
@@ -103,83 +187,131 @@ int main (int argc, char *argv[])
 		return 1;
 	}
 
+	if (ioclass && (set_io_class (ioclass) < 0)) {
+		printf ("Can't set the I/O class to '%s'\n", ioclass);
+		return 1;
+	}
+
+	/* Reading ahead would wait for the slow copies, one at a time */
+	if (ldm_hedge_ms > 0)
+		ldm_read_copies_hook = hedge_read_copies;
+	else
+		ldm_readahead_hook = sector_cache_prefetch;
+
+	/* The debug messages would come out in the wrong order */
+	if ((ldm_threads > 1) && !debug)
+		ldm_get_vblks_hook = ldm_get_vblks_par;
+
+	/* Members of a disk group share one database, so keep them all */
+	ldbs = kmalloc (argc * sizeof (*ldbs), GFP_KERNEL);
+	if (!ldbs)
+		return 1;
+	memset (ldbs, 0, argc * sizeof (*ldbs));
+
 	for (a = 1; a < argc; a++) {
 		long long size;
-		struct ldmdb     ldb; //FIXME move to heap
+		struct ldmdb *ldb;
 		struct parsed_partitions pp;
 
 		if (!argv[a][0])
 			continue;
 
-		if (stat64 (argv[a], &st)) {
-			printf ("Couldn't open device (stat): %s\n", argv[a]);
-			break;
+		if (!ldm_probe_wanted (basename (argv[a]))) {
+			printf ("Not probing device '%s'\n", argv[a]);
+			continue;
 		}
 
-		if ((!S_ISBLK (st.st_mode)) && (!S_ISREG (st.st_mode))) {
-			printf ("Couldn't open device (dev/file): %s\n", argv[a]);
+		if (dev_open (argv[a], &size) < 0)
 			break;
-		}
 
-		device = open64 (argv[a], O_RDONLY);
-		if (device < 0) {
-			printf ("Couldn't open device (open): %s\n", argv[a]);
-			break;
+		if (copy && comp) {
+			copy_compressed (argv[a], size);
+			goto close;
+		} else if (copy) {
+			copy_database (argv[a], size);
+			goto close;
 		}
 
-		size = lseek64 (device, 0, SEEK_END);
-		if (size < 0) {
-			printf ("Seek failed for device: %s\n", argv[a]);
-			break;
-		}
+		memset (&bdev, 0, sizeof (bdev));
+		bdev.bd_inode = &ino;
+		ino.i_size = size;
 
-		if (copy) {
-			copy_database (argv[a], device, size);
+		if (strm) {
+			printf ("Device: %s\n\n", argv[a]);
+			budget_begin();
+			if (ldm_stream (&bdev, dump_vblk, NULL) != 1)
+				skip_device (argv[a]);
+			budget_end();
 			goto close;
 		}
 
-		/* Initialize vblk list in ldmdb struct */
-		INIT_LIST_HEAD(&ldb.v_dgrp);
-		INIT_LIST_HEAD(&ldb.v_disk);
-		INIT_LIST_HEAD(&ldb.v_volu);
-		INIT_LIST_HEAD(&ldb.v_comp);
-		INIT_LIST_HEAD(&ldb.v_part);
+		ldb = kmalloc (sizeof (*ldb), GFP_KERNEL);
+		if (!ldb)
+			break;
+		memset (ldb, 0, sizeof (*ldb));
+		ldbs[a] = ldb;
 
-		memset (&bdev, 0, sizeof (bdev));
-		bdev.bd_inode = &ino;
-		ino.i_size = size;
+		/* Initialize vblk list in ldmdb struct */
+		INIT_LIST_HEAD(&ldb->v_dgrp);
+		INIT_LIST_HEAD(&ldb->v_disk);
+		INIT_LIST_HEAD(&ldb->v_volu);
+		INIT_LIST_HEAD(&ldb->v_comp);
+		INIT_LIST_HEAD(&ldb->v_part);
 
 		memset (&pp, 0, sizeof (pp));
+		strncpy (pp.name, basename (argv[a]), sizeof (pp.name) - 1);
 		pp.parts[0].from = 0;
 		pp.parts[0].size = size >> 9;
 		pp.limit = 255;
 
-		if (ldm_partition (&pp, &bdev, &ldb) != 1) {
-			printf ("Something went wrong, skipping device '%s'\n", argv[a]);
-			goto free;
+		budget_begin();
+		result = ldm_partition (&pp, &bdev, ldb);
+		budget_end();
+		if (result != 1) {
+			skip_device (argv[a]);
+			/* Show what we got, if we got as far as the database */
+			if (ldm_budget_spent && dump && ldb->vm.vblk_size) {
+				printf ("Partial result:\n");
+				dump_database (argv[a], ldb);
+			}
+			goto close;
 		}
 
 		if (dump)
-			dump_database (argv[a], &ldb);
-		else
+			dump_database (argv[a], ldb);
+		else if (lookup)
+			lookup_sectors (argv[a], ldb, lookup);
+		else if (!check)
 			dump_info     (argv[a], &pp);
-
-free:
-		ldm_free_vblks(&ldb.v_dgrp);
-		ldm_free_vblks(&ldb.v_disk);
-		ldm_free_vblks(&ldb.v_volu);
-		ldm_free_vblks(&ldb.v_comp);
-		ldm_free_vblks(&ldb.v_part);
+		if (check && (check_database (argv[a], ldb) != 0))
+			problems++;
 close:
-		close (device);
-		device = 0;
+		dev_close();
+	}
+
+	dev_close();
+	ldm_group_free();
+
+	for (a = 1; a < argc; a++) {
+		if (!ldbs[a])
+			continue;
+		ldm_free_vblks(&ldbs[a]->v_dgrp);
+		ldm_free_vblks(&ldbs[a]->v_disk);
+		ldm_free_vblks(&ldbs[a]->v_volu);
+		ldm_free_vblks(&ldbs[a]->v_comp);
+		ldm_free_vblks(&ldbs[a]->v_part);
+		kfree (ldbs[a]);
 	}
+	kfree (ldbs);
 
-	if (device)
-		close (device);
+	if (debug)
+		printf ("Sector cache: %d hits, %d misses, %d reads\n",
+			ldm_cache_hits, ldm_cache_misses, ldm_cache_reads);
+	if (debug && ldm_hedge_ms)
+		printf ("Hedged reads: %d late\n", ldm_hedge_late);
 
 	//printf ("%d/%d %d,%d\n", ldm_mem_alloc, ldm_mem_free, ldm_mem_maxa, ldm_mem_maxc);
-	return 0;
+	return problems ? 2 : 0;
 }
 
 
@@ -28,8 +28,9 @@ typedef unsigned char	BOOL;
 #define LDM_INFO	KERN_INFO
 #define LDM_DEBUG	KERN_DEBUG
 
-extern int device;
 extern int debug;
+extern __thread int printk_quiet;
+extern int ldm_threads;
 
 extern int ldm_mem_alloc;
 extern int ldm_mem_free;
@@ -39,14 +40,118 @@ extern int ldm_mem_count;
 extern int ldm_mem_maxc;
 
 void dump_database (char *name, struct ldmdb *ldb);
-void copy_database (char *file, int fd, long long size);
+int  check_database (char *name, struct ldmdb *ldb);
+int  dump_vblk     (struct vblk *vb, void *arg);
+void copy_database (char *file, long long size);
+void copy_compressed (char *file, long long size);
 void ldm_free_vblks (struct list_head *vb);
 
+/* Parts of ldm.c, which exports everything in userspace */
+BOOL ldm_parse_vblk   (const u8 *buf, int len, struct vblk *vb);
+BOOL ldm_vblk_wanted  (u8 type);
+void ldm_ldmdb_insert (struct vblk *vb, struct ldmdb *ldb);
+struct frag * ldm_frag_add (const u8 *data, int size, struct list_head *frags);
+void ldm_frag_free    (struct list_head *list);
+struct vblk * ldm_get_disk_objid (const struct ldmdb *ldb, const u8 *disk_id);
+
+BOOL ldm_probe_wanted (const char *name);
+
+int  ldm_get_vblks_par (struct block_device *bdev, unsigned long base, struct ldmdb *ldb);
+
+/* thread.c, which keeps <pthread.h> away from the kernel headers */
+struct ldm_thread;
+struct ldm_thread * thread_start (void *(*start) (void *), void *arg);
+void thread_join   (struct ldm_thread *t);
+int  thread_detach (void *(*start) (void *), void *arg);
+
+/*
+ * Compressed capture, NAME.ldmz.  All numbers are big-endian.
+ *
+ *	"LDMZ0001", device size (8), block size (4), reserved (4)
+ *	"EXTN" offset (8)			Start of an extent of the disk
+ *	"BLCK" length (4) stored (4) data	One block of the extent; if stored
+ *						equals length, it's uncompressed
+ *	"BLCK" 0 0				End of the extent
+ *	"DONE" extents (4) crc32 (4)		CRC of all the uncompressed data
+ */
+#define LDMZ_MAGIC	"LDMZ0001"
+#define LDMZ_HEADER	24
+#define LDMZ_BLOCK	65536
+#define LDMZ_BOUND(n)	((n) + (n) / 128 + 16)
+#define LDMZ_EXTENTS	8
+
+int ldmz_compress   (const u8 *src, int len, u8 *dst);
+int ldmz_decompress (const u8 *src, int slen, u8 *dst, int dlen);
+u32 ldmz_crc32      (u32 crc, const u8 *buf, int len);
+
+/*
+ * The partitions of one disk, sorted by where they start on the disk, and
+ * what each one belongs to.  start and end are sectors of the physical disk.
+ */
+struct ldm_lookup_ext {
+	u64		start;
+	u64		end;		/* First sector after the partition */
+	struct vblk	*part;
+	struct vblk	*comp;		/* NULL if missing from the database */
+	struct vblk	*volu;
+};
+
+struct ldm_index {
+	int			count;
+	struct ldm_lookup_ext	ext[0];
+};
+
+struct ldm_index * lookup_build (struct ldmdb *ldb);
+int lookup_batch   (const struct ldm_index *idx, const u64 *lba, int count,
+		    const struct ldm_lookup_ext **out);
+int lookup_offset  (const struct ldm_lookup_ext *e, u64 lba, u64 *off);
+int lookup_sectors (char *name, struct ldmdb *ldb, const char *file);
+
+int  dev_open  (const char *name, long long *size);
+void dev_close (void);
+int  dev_read  (void *buf, long long offset, int len);
+
+extern int ldm_cache_hits;
+extern int ldm_cache_misses;
+extern int ldm_cache_reads;
+void sector_cache_flush (void);
+void sector_cache_prefetch (struct block_device *bdev, unsigned long base,
+			    const int *off, int count);
+
+extern int ldm_budget_secs;
+extern int ldm_budget_reads;
+extern int ldm_budget_mem;
+extern const char *ldm_budget_spent;
+void budget_begin (void);
+void budget_end   (void);
+int  budget_read  (void);
+
+extern int ldm_limit_iops;
+extern int ldm_limit_bw;
+void throttle_read (int len);
+int  set_io_class  (const char *name);
+
+extern int ldm_hedge_ms;
+extern int ldm_hedge_late;
+void hedge_read_copies (struct block_device *bdev, unsigned long base,
+			const int *off, int count, u8 *buf, int *state);
+void hedge_drain (void);
+
 int		open64	(const char *file, int oflag, ...);
 long long	lseek64 (int fd, long long offset, int whence);
+ssize_t		pread64 (int fd, void *buf, size_t count, long long offset);
 int		stat64  (const char *file, struct stat64 *buf);
 int		isdigit	(int c);
 char *		basename(const char *filename);
+long long	strtoll (const char *nptr, char **endptr, int base);
+int		clock_gettime (int clock, struct timespec *tp);
+long		syscall (long number, ...);
+
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC	1
+#endif
+void		qsort	(void *base, size_t nmemb, size_t size,
+			 int (*compar) (const void *, const void *));
 
 #endif // __LDMINFO_H_
 
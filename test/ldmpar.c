@@ -0,0 +1,252 @@
+/**
+ * ldminfo - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Richard Russon <ldm@flatcap.org>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ldminfo.h"
+
+/*
+ * Decode the VBLKs in parallel.
+ *
+ * The whole VBLK area is read into memory and split into runs of records, one
+ * per thread.  Each thread decodes its single-record VBLKs into a table with
+ * one entry per record, without allocating memory or logging anything.  The
+ * tables are then merged in record order, which is also when the fragments
+ * are pieced together, so the lists come out exactly as the serial parser
+ * would build them.
+ *
+ * A VBLK that fails to decode is decoded again during the merge, so that the
+ * error is logged just as it would be normally.
+ */
+
+#define MAX_THREADS	64
+
+enum {				/* State of one record, after decoding */
+	SLOT_EMPTY = 0,		/* Not in use, or a type we don't want */
+	SLOT_VBLK,		/* Decoded */
+	SLOT_FRAG,		/* Part of a fragmented VBLK */
+	SLOT_FAILED,		/* Didn't decode */
+	SLOT_BAD		/* Not a VBLK at all */
+};
+
+struct slot {
+	struct vblk	vb;
+	int		state;
+};
+
+struct job {
+	const u8	*area;		/* Raw VBLK area */
+	int		size;		/* Size of a VBLK */
+	int		first;		/* Records first .. last-1 */
+	int		last;
+	struct slot	*slots;
+};
+
+int ldm_threads = 1;
+
+/**
+ * par_decode - Thread: decode a run of records
+ */
+static void * par_decode (void *arg)
+{
+	struct job *job = arg;
+	struct slot *slot;
+	const u8 *raw;
+	int recs;
+	int i;
+
+	printk_quiet = 1;
+
+	for (i = job->first; i < job->last; i++) {
+		raw  = job->area + i * job->size;
+		slot = job->slots + i;
+
+		if (MAGIC_VBLK != BE32 (raw)) {
+			slot->state = SLOT_BAD;
+			continue;
+		}
+
+		recs = BE16 (raw + 0x0E);
+		if (recs > 1) {
+			slot->state = SLOT_FRAG;
+		} else if ((recs == 0) || !ldm_vblk_wanted (raw[0x13])) {
+			slot->state = SLOT_EMPTY;
+		} else {
+			memset (&slot->vb, 0, sizeof (slot->vb));
+			if (ldm_parse_vblk (raw, job->size, &slot->vb))
+				slot->state = SLOT_VBLK;
+			else
+				slot->state = SLOT_FAILED;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * par_add - Copy a decoded VBLK into the database
+ */
+static int par_add (const struct vblk *src, struct ldmdb *ldb)
+{
+	struct vblk *vb;
+
+	vb = kmalloc (sizeof (*vb), GFP_KERNEL);
+	if (!vb) {
+		printk (LDM_CRIT "%s(): Out of memory.\n", __FUNCTION__);
+		return 0;
+	}
+
+	memcpy (vb, src, sizeof (*vb));
+	ldm_ldmdb_insert (vb, ldb);
+	return 1;
+}
+
+/**
+ * par_merge - Add the decoded VBLKs to the database, in record order
+ */
+static int par_merge (const u8 *area, int size, int count, struct slot *slots,
+		      struct ldmdb *ldb)
+{
+	struct vblk tmp;
+	struct frag *f;
+	const u8 *raw;
+	int result = 0;
+	int i;
+	LIST_HEAD (frags);
+
+	for (i = 0; i < count; i++) {
+		raw = area + i * size;
+
+		switch (slots[i].state) {
+		case SLOT_EMPTY:
+			continue;
+		case SLOT_VBLK:
+			if (!par_add (&slots[i].vb, ldb))
+				goto out;
+			continue;
+		case SLOT_FAILED:
+			ldm_parse_vblk (raw, size, &tmp);	/* Log it */
+			goto out;
+		case SLOT_BAD:
+			printk (LDM_ERR "%s(): Expected to find a VBLK.\n",
+				__FUNCTION__);
+			goto out;
+		}
+
+		f = ldm_frag_add (raw, size, &frags);
+		if (!f)
+			goto out;		/* Already logged */
+		if (f->map != 0xFF)
+			continue;
+
+		if (ldm_vblk_wanted (f->data[0x13])) {
+			memset (&tmp, 0, sizeof (tmp));
+			if (!ldm_parse_vblk (f->data, VBLK_SIZE_HEAD +
+					     f->num * (size - VBLK_SIZE_HEAD), &tmp) ||
+			    !par_add (&tmp, ldb))
+				goto out;
+		}
+		list_del (&f->list);
+		kfree (f);
+	}
+
+	if (!list_empty (&frags)) {
+		f = list_entry (frags.next, struct frag, list);
+		printk (LDM_ERR "%s(): VBLK group %d is incomplete (0x%02x).\n",
+			__FUNCTION__, f->group, f->map);
+		goto out;
+	}
+
+	result = 1;
+out:
+	ldm_frag_free (&frags);
+	return result;
+}
+
+/**
+ * ldm_get_vblks_par - Read the VBLKs, decoding them with several threads
+ *
+ * This replaces ldm_get_vblks (through ldm_get_vblks_hook) and builds the
+ * same lists in @ldb.
+ */
+int ldm_get_vblks_par (struct block_device *bdev, unsigned long base,
+		       struct ldmdb *ldb)
+{
+	struct ldm_thread *thread[MAX_THREADS];
+	struct job job[MAX_THREADS];
+	struct slot *slots = NULL;
+	u8 *area = NULL;
+	u8 *data;
+	Sector sect;
+	int size, skip, finish, count, per, threads, s, t;
+	int result = 0;
+
+	size   = ldb->vm.vblk_size;
+	skip   = ldb->vm.vblk_offset >> 9;		/* Bytes to sectors */
+	finish = (size * ldb->vm.last_vblk_seq) >> 9;
+	count  = (finish - skip) * (512 / size);
+	if ((size < VBLK_SIZE_HEAD) || (count <= 0))
+		return 1;
+
+	area  = kmalloc ((finish - skip) << 9, GFP_KERNEL);
+	slots = kmalloc (count * sizeof (*slots), GFP_KERNEL);
+	if (!area || !slots) {
+		printk (LDM_CRIT "%s(): Out of memory.\n", __FUNCTION__);
+		goto out;
+	}
+
+	for (s = skip; s < finish; s++) {
+		data = read_dev_sector (bdev, base + OFF_VMDB + s, &sect);
+		if (!data) {
+			printk (LDM_CRIT "%s(): Disk read failed.\n", __FUNCTION__);
+			goto out;
+		}
+		memcpy (area + ((s - skip) << 9), data, 512);
+		put_dev_sector (sect);
+	}
+
+	threads = min (min (ldm_threads, MAX_THREADS), count);
+	per = (count + threads - 1) / threads;
+
+	for (t = 0; t < threads; t++) {
+		job[t].area  = area;
+		job[t].size  = size;
+		job[t].first = min (t * per, count);
+		job[t].last  = min ((t + 1) * per, count);
+		job[t].slots = slots;
+	}
+
+	for (t = 0; t < threads; t++)
+		if (!(thread[t] = thread_start (par_decode, &job[t])))
+			break;
+
+	for (s = t; s < threads; s++)
+		par_decode (&job[s]);		/* Do the rest ourselves */
+	printk_quiet = 0;
+	while (t-- > 0)
+		thread_join (thread[t]);
+
+	result = par_merge (area, size, count, slots, ldb);
+out:
+	kfree (area);
+	kfree (slots);
+	return result;
+}
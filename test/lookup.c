@@ -0,0 +1,332 @@
+/**
+ * ldminfo - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Richard Russon <ldm@flatcap.org>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "ldminfo.h"
+
+/*
+ * Find the partition, component and volume that hold a sector of this disk.
+ *
+ * This disk's partitions are put in an array, in order of where they start
+ * on the disk, each with its component and volume already looked up.  The
+ * partitions of one disk don't overlap (--check would say if they did), so
+ * the array is an interval index: one binary search finds the extent that
+ * holds a sector.  Neighbouring sectors usually land in the same extent, so
+ * that's tried first.
+ */
+
+#define LOOKUP_BATCH	4096
+
+/**
+ * lookup_cmp_id - Order VBLKs by object id
+ */
+static int lookup_cmp_id (const void *a, const void *b)
+{
+	const struct vblk *x = *(struct vblk * const *) a;
+	const struct vblk *y = *(struct vblk * const *) b;
+
+	if (x->obj_id != y->obj_id)
+		return (x->obj_id < y->obj_id) ? -1 : 1;
+	return 0;
+}
+
+/**
+ * lookup_cmp_start - Order extents by their first sector
+ */
+static int lookup_cmp_start (const void *a, const void *b)
+{
+	const struct ldm_lookup_ext *x = a;
+	const struct ldm_lookup_ext *y = b;
+
+	if (x->start != y->start)
+		return (x->start < y->start) ? -1 : 1;
+	return 0;
+}
+
+/**
+ * lookup_sorted - Make an array of a list's VBLKs, sorted by object id
+ */
+static struct vblk ** lookup_sorted (struct list_head *head, int *count)
+{
+	struct list_head *item;
+	struct vblk **array;
+	int n = 0;
+
+	list_for_each (item, head)
+		n++;
+
+	array = kmalloc ((n + 1) * sizeof (*array), GFP_KERNEL);
+	if (!array)
+		return NULL;
+
+	n = 0;
+	list_for_each (item, head)
+		array[n++] = list_entry (item, struct vblk, list);
+
+	qsort (array, n, sizeof (*array), lookup_cmp_id);
+	*count = n;
+	return array;
+}
+
+/**
+ * lookup_find - Binary search a sorted array of VBLKs for an object id
+ */
+static struct vblk * lookup_find (struct vblk **array, int count, u64 id)
+{
+	int lo = 0;
+	int hi = count;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (array[mid]->obj_id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo < count) && (array[lo]->obj_id == id))
+		return array[lo];
+	return NULL;
+}
+
+/**
+ * lookup_build - Index the partitions of this disk
+ * @ldb:  This disk's database
+ *
+ * The VBLKs are those of the database, which must outlive the index.  A
+ * partition whose component or volume is missing is still indexed, without
+ * them.
+ *
+ * Return:  Pointer, the index, to be freed with kfree
+ *          NULL,    This disk isn't in the database, or out of memory
+ */
+struct ldm_index * lookup_build (struct ldmdb *ldb)
+{
+	struct ldmdb *db = ldm_group_db (ldb);	/* May be another disk's */
+	struct ldm_index *idx = NULL;
+	struct vblk **comps, **volus;
+	struct list_head *item;
+	struct vblk *disk;
+	int ncomps = 0;
+	int nvolus = 0;
+	int n = 0;
+
+	disk = ldm_get_disk_objid (db, ldb->ph.disk_id);
+	if (!disk) {
+		printk (LDM_ERR "Can't find the ID of this disk in the database.\n");
+		return NULL;
+	}
+
+	comps = lookup_sorted (&db->v_comp, &ncomps);
+	volus = lookup_sorted (&db->v_volu, &nvolus);
+
+	list_for_each (item, &db->v_part)
+		n++;
+
+	idx = kmalloc (sizeof (*idx) + n * sizeof (idx->ext[0]), GFP_KERNEL);
+	if (!comps || !volus || !idx) {
+		printk (LDM_CRIT "%s(): Out of memory.\n", __FUNCTION__);
+		kfree (idx);
+		idx = NULL;
+		goto out;
+	}
+
+	idx->count = 0;
+	list_for_each (item, &db->v_part) {
+		struct vblk *vb = list_entry (item, struct vblk, list);
+		struct ldm_lookup_ext *e = idx->ext + idx->count;
+
+		if (vb->vblk.part.disk_id != disk->obj_id)
+			continue;
+
+		e->start = ldb->ph.logical_disk_start + vb->vblk.part.start;
+		e->end   = e->start + vb->vblk.part.size;
+		e->part  = vb;
+		e->comp  = lookup_find (comps, ncomps, vb->vblk.part.parent_id);
+		e->volu  = NULL;
+		if (e->comp)
+			e->volu = lookup_find (volus, nvolus,
+					       e->comp->vblk.comp.parent_id);
+		idx->count++;
+	}
+
+	qsort (idx->ext, idx->count, sizeof (idx->ext[0]), lookup_cmp_start);
+out:
+	kfree (comps);
+	kfree (volus);
+	return idx;
+}
+
+/**
+ * lookup_batch - Find the extents that hold some sectors
+ * @idx:    Index of this disk's partitions
+ * @lba:    Sectors of the physical disk
+ * @count:  Number of sectors
+ * @out:    For each sector, its extent, or NULL if it isn't in a partition
+ *
+ * Return:  The number of sectors that were found
+ */
+int lookup_batch (const struct ldm_index *idx, const u64 *lba, int count,
+		  const struct ldm_lookup_ext **out)
+{
+	const struct ldm_lookup_ext *last = NULL;
+	int found = 0;
+	int lo, hi, mid, i;
+
+	for (i = 0; i < count; i++) {
+		if (!last || (lba[i] < last->start) || (lba[i] >= last->end)) {
+			/* Find the last extent starting at or before the sector */
+			lo = 0;
+			hi = idx->count;
+			while (lo < hi) {
+				mid = (lo + hi) / 2;
+				if (idx->ext[mid].start <= lba[i])
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			last = NULL;
+			if ((lo > 0) && (lba[i] < idx->ext[lo-1].end))
+				last = idx->ext + lo - 1;
+		}
+
+		out[i] = last;
+		if (last)
+			found++;
+	}
+
+	return found;
+}
+
+/**
+ * lookup_offset - Work out where a sector is in its volume
+ * @e:    The extent holding the sector
+ * @lba:  Sector of the physical disk
+ * @off:  The sector's offset into the volume
+ *
+ * A simple or spanned volume is its partitions end to end.  A stripe set
+ * takes a chunk from each partition in turn, ordered by partnum.  The layout
+ * of the parity in a RAID-5 set isn't known, so neither are its offsets.
+ *
+ * Return:  1  @off is set
+ *          0  The offset can't be worked out
+ */
+int lookup_offset (const struct ldm_lookup_ext *e, u64 lba, u64 *off)
+{
+	const struct vblk_comp *comp;
+	u64 o = lba - e->start;
+	u64 chunk;
+
+	if (!e->comp)
+		return 0;
+
+	comp = &e->comp->vblk.comp;
+	switch (comp->type) {
+	case COMP_BASIC:
+		*off = e->part->vblk.part.volume_offset + o;
+		return 1;
+	case COMP_STRIPE:
+		if (!comp->chunksize || (e->part->vblk.part.partnum >= comp->children))
+			return 0;
+		chunk = o / comp->chunksize;
+		*off  = (chunk * comp->children + e->part->vblk.part.partnum) *
+			comp->chunksize + o % comp->chunksize;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * lookup_sectors - Read sectors from a file, and say what holds each one
+ * @name:  Name of the device
+ * @ldb:   This disk's database
+ * @file:  One sector number per line, or "-" for stdin
+ *
+ * Each sector is printed with its volume, component and partition, and the
+ * offset into the volume, or "-" if it isn't in a partition.  An offset that
+ * can't be worked out is printed as "?".
+ *
+ * Return:  1  Success
+ *          0  Error
+ */
+int lookup_sectors (char *name, struct ldmdb *ldb, const char *file)
+{
+	static u64 lba[LOOKUP_BATCH];
+	static const struct ldm_lookup_ext *ext[LOOKUP_BATCH];
+	struct ldm_index *idx;
+	char line[64];
+	FILE *f;
+	int n, i;
+
+	idx = lookup_build (ldb);
+	if (!idx)
+		return 0;
+
+	if (strcmp (file, "-") == 0)
+		f = stdin;
+	else
+		f = fopen (file, "r");
+	if (!f) {
+		printf ("Can't open '%s'\n", file);
+		kfree (idx);
+		return 0;
+	}
+
+	printf ("Device: %s\n\n", name);
+	printf ("Sector Volume Component Partition VolumeOffset\n");
+
+	do {
+		for (n = 0; (n < LOOKUP_BATCH) && fgets (line, sizeof (line), f); )
+			if (isdigit (line[0]))
+				lba[n++] = strtoll (line, NULL, 0);
+
+		lookup_batch (idx, lba, n, ext);
+
+		for (i = 0; i < n; i++) {
+			const struct ldm_lookup_ext *e = ext[i];
+			u64 off;
+
+			if (!e) {
+				printf ("%llu -\n", (unsigned long long) lba[i]);
+				continue;
+			}
+			printf ("%llu %s %s %s ", (unsigned long long) lba[i],
+				e->volu ? (char *) e->volu->name : "?",
+				e->comp ? (char *) e->comp->name : "?",
+				e->part->name);
+			if (lookup_offset (e, lba[i], &off))
+				printf ("%llu\n", (unsigned long long) off);
+			else
+				printf ("?\n");
+		}
+	} while (n == LOOKUP_BATCH);
+
+	printf ("\n");
+	if (f != stdin)
+		fclose (f);
+	kfree (idx);
+	return 1;
+}
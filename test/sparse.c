@@ -22,6 +22,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -29,83 +30,157 @@
 #include <errno.h>
 #include <string.h>
 
-int main (int argc, char *argv[])
+#define LDM_DB_SIZE	2048		/* Size in sectors (= 1MiB). */
+#define BUFSIZE		(1 << 20)	/* Fallback copy buffer */
+
+static char *buffer;
+
+/**
+ * copy_fallback - Copy the rest of a file using a large buffer
+ */
+static int copy_fallback (int fin, int fout, __off64_t off)
 {
-	char buf[512];
-	char *part;
-	char *data;
-	char *out;
-	int fpart;
-	int fdata;
-	int fout;
-	__off64_t off;
+	ssize_t got;
 
-	if (argc != 5) {
-		printf ("\nUsage:\n\t%s part data sectors output\n\n", basename (argv[0]));
-		return 1;
+	if (!buffer) {
+		buffer = malloc (BUFSIZE);
+		if (!buffer)
+			return -1;
 	}
 
-	part = argv[1];
-	data = argv[2];
-	out  = argv[4];
-	off  = atol (argv[3]);
+	while ((got = read (fin, buffer, BUFSIZE)) > 0) {
+		if (pwrite (fout, buffer, got, off) != got)
+			return -1;
+		off += got;
+	}
+
+	return got;
+}
 
-	if (off == 0) {
-		printf ("Sectors must be non-zero\n");
+/**
+ * copy_file - Copy a whole file into the image at a given offset
+ *
+ * Let the kernel move the data with copy_file_range, if it can.  Older
+ * kernels, or copies between filesystems, fall back to read/write.
+ */
+static int copy_file (int fin, int fout, __off64_t off)
+{
+	ssize_t done;
+
+	do {
+		done = copy_file_range (fin, NULL, fout, &off, BUFSIZE, 0);
+	} while (done > 0);
+
+	if (done == 0)
+		return 0;
+
+	if ((errno != ENOSYS) && (errno != EXDEV) &&
+	    (errno != EINVAL) && (errno != EOPNOTSUPP))
+		return -1;
+
+	return copy_fallback (fin, fout, off);
+}
+
+/**
+ * build_image - Rebuild one disk image from its .part and .data files
+ *
+ * The image is sized with ftruncate first, so everything between the
+ * partition table and the database remains a hole.
+ */
+static int build_image (char *part, char *data, char *sectors, char *out)
+{
+	struct stat64 st;
+	__off64_t size;
+	__off64_t off;
+	int fpart = -1;
+	int fdata = -1;
+	int fout  = -1;
+	int result = 1;
+
+	size = strtoll (sectors, NULL, 0);
+	if (size < LDM_DB_SIZE) {
+		printf ("Sectors must be at least %d\n", LDM_DB_SIZE);
 		return 1;
 	}
 
-	off -= 2048;
-	off <<= 9;
+	off    = (size - LDM_DB_SIZE) << 9;
+	size <<= 9;
 
 	fpart = open (part, O_RDONLY);
 	if (fpart < 0) {
 		printf ("Cannot open part file '%s'\n", part);
-		return 1;
+		goto out;
+	}
+
+	if ((fstat64 (fpart, &st) < 0) || (st.st_size > off)) {
+		printf ("Part file '%s' overlaps the database\n", part);
+		goto out;
 	}
 
 	fdata = open (data, O_RDONLY);
 	if (fdata < 0) {
 		printf ("Cannot open data file '%s'\n", data);
-		return 1;
+		goto out;
 	}
 
 	fout = open (out, O_RDWR | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
 	if (fout < 0) {
 		printf ("Cannot open output file '%s'\n", out);
-		return 1;
+		goto out;
 	}
 
-	while (read (fpart, buf, sizeof (buf)) == sizeof (buf))
-	{
-		if (write (fout, buf, sizeof (buf)) < sizeof (buf)) {
-			printf ("Cannot write to '%s'\n", part);
-			return 1;
-		}
-	}
-
-	if (lseek64 (fout, off, SEEK_SET) < 0)
-	{
-		printf ("Seek failed (%s) in '%s', offset %llu\n",
-			strerror (errno), out, off);
+	if (ftruncate64 (fout, size) < 0) {
+		printf ("Truncate failed (%s) in '%s', size %lld\n",
+			strerror (errno), out, (long long) size);
 		printf ("Check this isn't limitation of your filesystem\n");
 		printf ("e.g. By default ext2 has a limit of 16Gb\n");
+		goto out;
+	}
+
+	/* Reserve the database extent, leaving the gap as a hole */
+	fallocate64 (fout, FALLOC_FL_KEEP_SIZE, off, size - off);
+
+	if (copy_file (fpart, fout, 0) < 0) {
+		printf ("Cannot write '%s' to '%s'\n", part, out);
+		goto out;
+	}
+
+	if (copy_file (fdata, fout, off) < 0) {
+		printf ("Cannot write '%s' to '%s'\n", data, out);
+		goto out;
+	}
+
+	result = 0;
+out:
+	if (fpart >= 0)
+		close (fpart);
+	if (fdata >= 0)
+		close (fdata);
+	if (fout >= 0)
+		close (fout);
+	return result;
+}
+
+int main (int argc, char *argv[])
+{
+	int failed = 0;
+	int a;
+
+	if ((argc < 5) || ((argc - 1) % 4)) {
+		printf ("\nUsage:\n\t%s part data sectors output [part data sectors output ...]\n\n", basename (argv[0]));
 		return 1;
 	}
 
-	while (read (fdata, buf, sizeof (buf)) == sizeof (buf))
-	{
-		if (write (fout, buf, sizeof (buf)) < sizeof (buf)) {
-			printf ("Cannot write to '%s'\n", data);
-			return 1;
-		}
+	for (a = 1; a < argc; a += 4)
+		failed += build_image (argv[a], argv[a+1], argv[a+2], argv[a+3]);
+
+	free (buffer);
+
+	if (failed) {
+		printf ("Failed to build %d image%s\n", failed, (failed > 1) ? "s" : "");
+		return 1;
 	}
 
-	close (fpart);
-	close (fdata);
-	close (fout);
-	
 	printf ("Succeeded\n");
 	return 0;
 }
-
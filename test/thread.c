@@ -0,0 +1,82 @@
+/**
+ * ldminfo - Part of the Linux-NTFS project.
+ *
+ * Copyright (C) 2001 Richard Russon <ldm@flatcap.org>
+ *
+ * Documentation is available at http://linux-ntfs.sourceforge.net/ldm
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS source
+ * in the file COPYING); if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Threads for ldminfo.
+ *
+ * <pthread.h> can't be used in a file that includes the kernel headers, so
+ * ldmpar.c and hedge.c start their threads through these functions.  This is
+ * the only file that sees the real pthread declarations.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct ldm_thread {
+	pthread_t	id;
+};
+
+/**
+ * thread_start - Start a thread that will be joined by thread_join
+ */
+struct ldm_thread * thread_start (void *(*start) (void *), void *arg)
+{
+	struct ldm_thread *t;
+
+	t = malloc (sizeof (*t));
+	if (!t)
+		return NULL;
+
+	if (pthread_create (&t->id, NULL, start, arg) != 0) {
+		free (t);
+		return NULL;
+	}
+
+	return t;
+}
+
+/**
+ * thread_join - Wait for a thread to finish
+ */
+void thread_join (struct ldm_thread *t)
+{
+	if (!t)
+		return;
+
+	pthread_join (t->id, NULL);
+	free (t);
+}
+
+/**
+ * thread_detach - Start a thread that nobody waits for
+ */
+int thread_detach (void *(*start) (void *), void *arg)
+{
+	pthread_t id;
+
+	if (pthread_create (&id, NULL, start, arg) != 0)
+		return 0;
+
+	pthread_detach (id);
+	return 1;
+}